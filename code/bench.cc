@@ -0,0 +1,883 @@
+
+#include "r_draw.hh"
+#include "r_shader.hh"
+#include "e_profiler.hh"
+#include "e_threads.hh"
+
+#include "cube.hh"
+
+#define GLM_FORCE_PURE
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// headless benchmark and golden image checks, renders the cube field of the game into offscreen targets
+
+enum EBenchMode
+{
+    BM_BENCHMARK = 0,
+    BM_RECORD,        // renders the golden scenes and stores them as references
+    BM_COMPARE        // renders the golden scenes and compares them against stored references
+};
+
+struct FBenchConfig
+{
+    EBenchMode  mode      = BM_BENCHMARK;
+    const char* goldenDir = nullptr; // references and diff images
+
+    int  width    = 640;
+    int  height   = 480;
+    int  threads  = 0; // 0 picks the hardware concurrency
+    int  cubes    = 9;
+    int  frames   = 500;
+    int  warmup   = 20;
+    bool pipeline = false;
+    bool prepass  = false;
+    bool msaa     = false;
+    ECullMode cullMode = CM_CW;
+
+    const char* tracePath = nullptr; // Chrome trace of the measured frames, needs F_ENABLE_PROFILING
+
+    int   colorTolerance = 0; // per channel
+    float depthTolerance = 0.0F;
+};
+
+struct FSceneResources
+{
+    FVertexBuffer* cubeVB;
+    FIndexBuffer*  cubeIB;
+    FTexture*      checkerTex;
+    FTexture*      patternTex;
+    FPipeline*     litPipeline;
+
+    // 4x targets of the multisampled scenes, resolved into the scene's color target
+    FRenderTarget* msaaColorRT;
+    FRenderTarget* msaaDepthRT;
+
+    // the cube split into a position stream and a texcoord and normal stream
+    std::vector<float> splitPositions;
+    std::vector<float> splitAttributes;
+    FVertexBuffer*     splitPositionVB;
+    FVertexBuffer*     splitAttributeVB;
+    FVertexFormat*     splitFormat;
+
+    // 3 pixels narrower and shorter for the odd-sized scenes, so that their last blocks cross the edge
+    FRenderTarget* oddColorRT;
+    FRenderTarget* oddDepthRT;
+    FRenderTarget* oddMsaaColorRT;
+    FRenderTarget* oddMsaaDepthRT;
+
+    // records the scenes that are drawn through command buffers
+    FThreadPool*   recordPool;
+};
+
+struct FScene
+{
+    const char*   name;
+    int           cubes;
+    float         time;    // rotation of the cubes
+    float         cameraZ; // camera position like in the game, negative values move towards the field
+    ECullMode     cullMode;
+    FSamplerState sampler;
+    bool          pattern = false; // 64x64 pattern with a full mip chain instead of the 4x4 checker
+    bool          prepass = false; // depth-only pass first, then a DF_EQUAL shading pass
+    bool          lit     = false; // FLitShader with a tint per cube instead of the built-in pipeline
+    bool          streams = false; // the cube from two vertex streams, renders like the FixedVertex one
+    bool          blend   = false; // translucent lit shells around the cubes, alpha blended and additive in turns
+    bool          msaa    = false; // rendered with 4x multisampling
+    bool          record  = false; // recorded on the record pool, one command buffer per run of cubes, then submitted in order
+};
+
+// fixed scenes for the golden image checks, together they go through clipping, culling and every filter
+static const FScene g_goldenScenes[] = {
+    { "field",           9,   0.5F, 0.0F, CM_CW,   { TF_NEAREST,   TA_WRAP,  TA_WRAP  }, false },
+    { "field_large",     100, 1.7F, 0.0F, CM_CW,   { TF_NEAREST,   TA_WRAP,  TA_WRAP  }, false },
+    { "cull_none",       9,   0.9F, 0.0F, CM_NONE, { TF_NEAREST,   TA_WRAP,  TA_WRAP  }, false },
+    { "cull_ccw",        9,   0.9F, 0.0F, CM_CCW,  { TF_NEAREST,   TA_WRAP,  TA_WRAP  }, false },
+    { "bilinear",        9,   1.3F, 0.0F, CM_CW,   { TF_BILINEAR,  TA_WRAP,  TA_WRAP  }, true  },
+    { "trilinear",       100, 2.1F, 0.0F, CM_CW,   { TF_TRILINEAR, TA_WRAP,  TA_WRAP  }, true  },
+    { "trilinear_clamp", 9,   2.9F, -4.0F, CM_CW,   { TF_TRILINEAR, TA_CLAMP, TA_CLAMP }, true  },
+    { "near_clip",       9,   0.7F, -8.4F, CM_CW,   { TF_BILINEAR,  TA_WRAP,  TA_WRAP  }, true  },
+    { "guard_band",      9,   3.3F, -7.5F, CM_CW,   { TF_NEAREST,   TA_WRAP,  TA_WRAP  }, false },
+    { "prepass",         100, 2.1F, 0.0F, CM_CW,   { TF_TRILINEAR, TA_WRAP,  TA_WRAP  }, true,  true },
+    { "shader",          9,   1.1F, 0.0F, CM_CW,   { TF_BILINEAR,  TA_WRAP,  TA_WRAP  }, true,  false, true },
+    { "shader_streams",  9,   1.1F, 0.0F, CM_CW,   { TF_BILINEAR,  TA_WRAP,  TA_WRAP  }, true,  false, true,  true },
+    { "blend",           9,   1.1F, 0.0F, CM_CW,   { TF_BILINEAR,  TA_WRAP,  TA_WRAP  }, true,  false, true,  false, true },
+    { "msaa",            9,   1.1F, 0.0F, CM_CW,   { TF_BILINEAR,  TA_WRAP,  TA_WRAP  }, true,  false, true,  false, true,  true },
+    { "command_buffers", 100, 2.1F, 0.0F, CM_CW,   { TF_TRILINEAR, TA_WRAP,  TA_WRAP  }, true,  true,  true,  false, true,  false, true },
+};
+
+// rendered into the odd-sized targets, the field covers the edges of the target
+static const FScene g_oddSizeScenes[] = {
+    { "odd_size",        100, 2.1F, -21.0F, CM_CW,  { TF_BILINEAR,  TA_WRAP,  TA_WRAP  }, true  },
+    { "odd_size_msaa",   100, 2.1F, -21.0F, CM_CW,  { TF_BILINEAR,  TA_WRAP,  TA_WRAP  }, true,  false, true,  false, true,  true },
+};
+
+struct FLitConstants
+{
+    float    light[3]; // direction towards the light in object space, normalized
+    float    ambient;
+    uint32_t tint;     // ARGB8, the alpha scales the texture's
+};
+
+// texture modulated by a directional light and a tint, goes through varyings and constants of custom shaders
+struct FLitShader
+{
+    static const uint32_t NumVaryings = 3; // texcoord, light
+    static const bool     Textured    = true;
+
+    static void ShadeVertex(const FVertexInput& in, const void* constants, float* varyings)
+    {
+        const FLitConstants& c = *static_cast<const FLitConstants*>(constants);
+
+        const float* normal   = in.attributes[VS_NORMAL];
+        const float* texcoord = in.attributes[VS_TEXCOORD0];
+
+        float diffuse = normal[0] * c.light[0] + normal[1] * c.light[1] + normal[2] * c.light[2];
+
+        varyings[0] = texcoord[0];
+        varyings[1] = texcoord[1];
+        varyings[2] = c.ambient + (diffuse > 0.0F ? diffuse : 0.0F) * (1.0F - c.ambient);
+    }
+
+    static void ShadePixels(const FPixelShaderInput& in, uint32_t colors[4])
+    {
+        const FLitConstants& c = *static_cast<const FLitConstants*>(in.constants);
+
+        SampleQuad(*in.sampler, in.varyings[0], in.varyings[1], colors);
+
+        for (int i = 0; i < 4; ++i) {
+            uint32_t light = static_cast<uint32_t>(in.varyings[2][i] * 256.0F);
+            light = light > 256 ? 256 : light;
+
+            uint32_t color = ((colors[i] >> 24) * (c.tint >> 24) / 255) << 24;
+            for (int shift = 0; shift < 24; shift += 8) {
+                uint32_t channel = ((colors[i] >> shift) & 0xFF) * ((c.tint >> shift) & 0xFF) / 255;
+                color |= ((channel * light) >> 8) << shift;
+            }
+            colors[i] = color;
+        }
+    }
+};
+
+// 4x4 checker, 2x2 texel squares
+static FTexture* CreateCheckerTexture()
+{
+    const uint32_t grey  = F_ARGB(255u, 127u, 127u, 127u);
+    const uint32_t white = F_ARGB(255u, 255u, 255u, 255u);
+
+    const uint32_t texels[4 * 4] = {
+        grey,  grey,  white, white,
+        grey,  grey,  white, white,
+        white, white, grey,  grey,
+        white, white, grey,  grey
+    };
+
+    return FTexture::Allocate(4, 4, texels);
+}
+
+// colored gradients with a fine checker on top, so that every mip level looks different
+static FTexture* CreatePatternTexture()
+{
+    const uint32_t size = 64;
+
+    std::vector<uint32_t> texels(size * size);
+    for (uint32_t y = 0; y < size; ++y) {
+        for (uint32_t x = 0; x < size; ++x) {
+            uint32_t checker = ((x ^ y) & 1) ? 64u : 0u;
+            uint32_t r       = x * 3u + checker;
+            uint32_t g       = y * 3u + checker;
+            uint32_t b       = 255u - x * 2u;
+            texels[y * size + x] = F_ARGB(255u, r, g, b);
+        }
+    }
+
+    return FTexture::Allocate(size, size, texels.data());
+}
+
+static void CreateSplitCube(FSceneResources& res)
+{
+    const size_t numVertices = sizeof(cubeVertices) / sizeof(cubeVertices[0]);
+
+    for (size_t i = 0; i < numVertices; ++i) {
+        const FVertexBuffer::FixedVertex& v = cubeVertices[i];
+        res.splitPositions.insert(res.splitPositions.end(), v.vs_position, v.vs_position + 3);
+        res.splitAttributes.insert(res.splitAttributes.end(), v.vs_texcoord, v.vs_texcoord + 2);
+        res.splitAttributes.insert(res.splitAttributes.end(), v.vs_normal, v.vs_normal + 3);
+    }
+
+    const FVertexElement elements[] = {
+        { VS_POSITION,  0, 0,                 3 },
+        { VS_TEXCOORD0, 1, 0,                 2 },
+        { VS_NORMAL,    1, 2 * sizeof(float), 3 },
+    };
+
+    res.splitPositionVB  = FVertexBuffer::Allocate(res.splitPositions.data(),  numVertices, 3 * sizeof(float));
+    res.splitAttributeVB = FVertexBuffer::Allocate(res.splitAttributes.data(), numVertices, 5 * sizeof(float));
+    res.splitFormat      = FVertexFormat::Allocate(elements, 3);
+}
+
+// placement of the cubes on the grid
+struct FSceneLayout
+{
+    int       columns;
+    int       rows;
+    float     distance;
+    glm::mat4 rotation;
+};
+
+static FSceneLayout GetSceneLayout(const FScene& scene)
+{
+    FSceneLayout layout;
+    layout.columns  = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(scene.cubes))));
+    layout.rows     = layout.columns > 0 ? (scene.cubes + layout.columns - 1) / layout.columns : 0;
+    layout.distance = 10.0F * (layout.columns > 3 ? layout.columns / 3.0F : 1.0F);
+    layout.rotation = glm::mat4_cast(glm::quat(glm::vec3(scene.time, scene.time, scene.time)));
+    return layout;
+}
+
+// targets, clear and the state that stays the same for the whole scene
+static void BeginScene(const FScene& scene, int width, int height, FRenderTarget* colorRT, FRenderTarget* depthRT, const FSceneResources& res)
+{
+    if (scene.msaa) {
+        bool oddSize = colorRT == res.oddColorRT;
+        fglSetRenderTarget(oddSize ? res.oddMsaaColorRT : res.msaaColorRT);
+        fglSetDepthStencilTarget(oddSize ? res.oddMsaaDepthRT : res.msaaDepthRT);
+        fglSetResolveTarget(colorRT);
+    } else {
+        fglSetRenderTarget(colorRT);
+        fglSetDepthStencilTarget(depthRT);
+        fglSetResolveTarget(nullptr);
+    }
+    fglClear(F_ARGB(0u, 255u, 255u, 0u), 1.0F);
+
+    fglSetCullMode(scene.cullMode);
+    fglSetSamplerState(scene.sampler);
+
+    glm::mat4 perspective = glm::perspective(45.0F, float(width) / float(height), 0.01F, 1000.0F) * glm::translate(glm::vec3(0.0F, 0.0F, -scene.cameraZ));
+
+    fglSetMatrix(DM_PROJECTION, glm::value_ptr(perspective));
+    fglSetPipeline(scene.lit ? res.litPipeline : nullptr);
+}
+
+// Cubes [first, last) of a pass: 0 is the depth prepass, 1 the opaque cubes and 2 the translucent shells over them.
+// Sets the state of the pass first, so that any run of cubes can be drawn on its own.
+static void DrawCubes(const FScene& scene, const FSceneLayout& layout, int pass, int first, int last, const FSceneResources& res)
+{
+    bool depthOnly = pass == 0;
+    bool shell     = pass == 2;
+
+    if (shell)
+        fglSetDepthState({ DF_LESS, false });
+    else
+        fglSetDepthState({ scene.prepass && !depthOnly ? DF_EQUAL : DF_LESS, depthOnly || !scene.prepass });
+    fglSetColorWrite(!depthOnly);
+    fglSetBlendState({ false, BF_ONE, BF_ZERO, BO_ADD });
+
+    for (int i = first; i < last; ++i) {
+        float x = (i % layout.columns - (layout.columns - 1) * 0.5F) * 5.0F;
+        float y = (i / layout.columns - (layout.rows - 1) * 0.5F) * 3.5F;
+
+        glm::mat4 modelview = glm::translate(glm::vec3(x, y, -layout.distance)) * layout.rotation;
+        if (shell) {
+            const FBlendState blends[] = { { true, BF_SRC_ALPHA, BF_INV_SRC_ALPHA, BO_ADD }, { true, BF_ONE, BF_ONE, BO_ADD } };
+
+            modelview = modelview * glm::scale(glm::vec3(1.3F));
+            fglSetBlendState(blends[i & 1]);
+        }
+
+        fglSetMatrix(DM_MODELVIEW, glm::value_ptr(modelview));
+        if (scene.streams) {
+            fglSetVertexFormat(res.splitFormat);
+            fglSetVertexStream(0, res.splitPositionVB);
+            fglSetVertexStream(1, res.splitAttributeVB);
+        } else {
+            fglSetVertexFormat(nullptr);
+            fglSetVertexBuffer(res.cubeVB);
+        }
+        fglSetIndexBuffer(res.cubeIB);
+        fglSetTexture(scene.pattern ? res.patternTex : res.checkerTex);
+
+        if (scene.lit) {
+            const uint32_t tints[] = { F_ARGB(255u, 255u, 160u, 160u), F_ARGB(255u, 160u, 255u, 160u), F_ARGB(255u, 160u, 160u, 255u) };
+
+            FLitConstants constants = { { 0.48F, 0.64F, 0.6F }, 0.25F, shell ? (tints[i % 3] & 0x00FFFFFF) | F_ARGB(96u, 0u, 0u, 0u) : tints[i % 3] };
+            fglSetShaderConstants(&constants, sizeof(constants));
+        }
+
+        fglDrawIndexed(0, 36);
+    }
+}
+
+// Records the scene in parallel: the first buffer begins the scene, every other one draws a run of cubes of one pass.
+// Submitted in order, the buffers make the same calls as RenderScene draws directly.
+static void RecordScene(const FScene& scene, int width, int height, FRenderTarget* colorRT, FRenderTarget* depthRT, const FSceneResources& res)
+{
+    const int cubesPerBuffer = 8;
+
+    FSceneLayout layout    = GetSceneLayout(scene);
+    int          firstPass = scene.prepass ? 0 : 1;
+    int          numPasses = (scene.blend ? 3 : 2) - firstPass;
+    int          numRuns   = (scene.cubes + cubesPerBuffer - 1) / cubesPerBuffer;
+
+    std::vector<FCommandBuffer*> cbs(1 + numPasses * numRuns);
+    for (FCommandBuffer*& cb: cbs)
+        cb = FCommandBuffer::Allocate();
+
+    res.recordPool->ParallelFor(cbs.size(), [&](size_t index, uint32_t) {
+        fglBeginCommandBuffer(cbs[index]);
+
+        if (index == 0) {
+            BeginScene(scene, width, height, colorRT, depthRT, res);
+        } else {
+            int pass  = firstPass + static_cast<int>(index - 1) / numRuns;
+            int first = static_cast<int>(index - 1) % numRuns * cubesPerBuffer;
+            DrawCubes(scene, layout, pass, first, std::min(first + cubesPerBuffer, scene.cubes), res);
+        }
+
+        fglEndCommandBuffer();
+    });
+
+    fglSubmit(cbs.data(), cbs.size());
+
+    for (FCommandBuffer* cb: cbs)
+        FCommandBuffer::Release(cb);
+}
+
+// cubes on a grid facing the camera, 9 cubes give the 3x3 field of the game, larger fields move further away
+static void RenderScene(const FScene& scene, int width, int height, FRenderTarget* colorRT, FRenderTarget* depthRT, const FSceneResources& res)
+{
+    if (scene.record) {
+        RecordScene(scene, width, height, colorRT, depthRT, res);
+        return;
+    }
+
+    FSceneLayout layout = GetSceneLayout(scene);
+
+    BeginScene(scene, width, height, colorRT, depthRT, res);
+
+    // the opaque cubes, optionally after a depth prepass, then the translucent shells over them
+    for (int pass = scene.prepass ? 0 : 1; pass < (scene.blend ? 3 : 2); ++pass)
+        DrawCubes(scene, layout, pass, 0, scene.cubes, res);
+}
+
+// benchmark
+static void AccumulateStatistics(FPipelineStatistics& sum, const FPipelineStatistics& frame)
+{
+    sum.trianglesSubmitted  += frame.trianglesSubmitted;
+    sum.verticesTransformed += frame.verticesTransformed;
+    sum.culledFrustum       += frame.culledFrustum;
+    sum.clippedTriangles    += frame.clippedTriangles;
+    sum.culledBackFace      += frame.culledBackFace;
+    sum.culledDegenerate    += frame.culledDegenerate;
+    sum.hizCulledTriangles  += frame.hizCulledTriangles;
+    sum.hizCulledBlocks     += frame.hizCulledBlocks;
+    sum.blocksSkipped       += frame.blocksSkipped;
+    sum.blocksFull          += frame.blocksFull;
+    sum.blocksPartial       += frame.blocksPartial;
+    sum.triangles           += frame.triangles;
+    sum.fragmentsTested     += frame.fragmentsTested;
+    sum.pixelsWritten       += frame.pixelsWritten;
+    sum.depthFailed         += frame.depthFailed;
+    sum.fragmentsShaded     += frame.fragmentsShaded;
+    sum.depthComplexity     += frame.depthComplexity;
+    sum.overdraw            += frame.overdraw;
+    sum.vertexTime          += frame.vertexTime;
+    sum.clearTime           += frame.clearTime;
+    sum.binTime             += frame.binTime;
+    sum.rasterTime          += frame.rasterTime;
+}
+
+static int RunBenchmark(const FBenchConfig& config, FRenderTarget* const colorRT[2], FRenderTarget* depthRT, const FSceneResources& res)
+{
+    FScene scene = { "benchmark", config.cubes, 0.5F, 0.0F, config.cullMode, { TF_NEAREST, TA_WRAP, TA_WRAP }, false, config.prepass };
+    scene.msaa = config.msaa;
+
+    FPipelineStatistics sum = {};
+    TFrameHandle        pendingFrame = 0;
+
+    std::chrono::steady_clock::time_point tmStart;
+
+    for (int frame = 0; frame < config.warmup + config.frames; ++frame) {
+        if (frame == config.warmup) {
+            fglWaitFrame(pendingFrame);
+            tmStart = std::chrono::steady_clock::now();
+
+            #ifdef F_ENABLE_PROFILING
+            F_ProfilerResetStatistics();
+            if (config.tracePath)
+                F_ProfilerBeginCapture();
+            #endif
+        }
+
+        scene.time += 0.005F;
+
+        // frames rasterize one at a time, so pipelining only needs a second color target
+        RenderScene(scene, config.width, config.height, colorRT[config.pipeline ? frame & 1 : 0], depthRT, res);
+
+        TFrameHandle handle = fglPresentAsync();
+        fglWaitFrame(config.pipeline ? pendingFrame : handle);
+        pendingFrame = handle;
+
+        if (frame >= config.warmup) {
+            FPipelineStatistics stats;
+            fglGetPipelineStatistics(&stats);
+            AccumulateStatistics(sum, stats);
+        }
+
+        #ifdef F_ENABLE_PROFILING
+        F_ProfilerEndFrame();
+        #endif
+    }
+
+    fglWaitFrame(pendingFrame);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tmStart).count();
+
+    #ifdef F_ENABLE_PROFILING
+    // pipelined frames are collected one frame late, the last one only finished now
+    if (config.pipeline)
+        F_ProfilerEndFrame();
+    if (config.tracePath && !F_ProfilerEndCapture(config.tracePath))
+        printf("can't write %s\n", config.tracePath);
+    #else
+    if (config.tracePath)
+        printf("built without F_ENABLE_PROFILING, no trace written\n");
+    #endif
+    double frames  = config.frames;
+
+    printf("%dx%d, %d cubes, %u threads, %s%s%s\n", config.width, config.height, config.cubes, fglGetThreadCount(), config.pipeline ? "pipelined" : "synchronous",
+           config.prepass ? ", depth prepass" : "", config.cullMode == CM_NONE ? ", no culling" : "");
+    printf("frames:      %d in %.3f s, %.1f fps, %.3f ms/frame\n", config.frames, seconds, frames / seconds, seconds * 1000.0 / frames);
+    printf("vertex:      %.3f ms/frame\n", sum.vertexTime / frames);
+    printf("clear:       %.3f ms/frame\n", sum.clearTime / frames);
+    printf("bin:         %.3f ms/frame\n", sum.binTime / frames);
+    printf("rasterize:   %.3f ms/frame\n", sum.rasterTime / frames);
+    printf("vertices:    %.0f/frame\n", sum.verticesTransformed / frames);
+    printf("submitted:   %.0f triangles/frame\n", sum.trianglesSubmitted / frames);
+    printf("triangles:   %.0f/frame, %.3f M/s\n", sum.triangles / frames, sum.triangles / seconds * 1e-6);
+    printf("pixels:      %.0f/frame, %.3f M/s\n", sum.pixelsWritten / frames, sum.pixelsWritten / seconds * 1e-6);
+    printf("culled:      %.0f frustum, %.0f back face, %.0f degenerate, %.0f clipped /frame\n",
+           sum.culledFrustum / frames, sum.culledBackFace / frames, sum.culledDegenerate / frames, sum.clippedTriangles / frames);
+    printf("blocks:      %.0f full, %.0f partial, %.0f skipped, %.0f hiz culled /frame\n",
+           sum.blocksFull / frames, sum.blocksPartial / frames, sum.blocksSkipped / frames, sum.hizCulledBlocks / frames);
+    printf("depth test:  %.0f passed, %.0f failed /frame, depth complexity %.2f\n", sum.pixelsWritten / frames, sum.depthFailed / frames, sum.depthComplexity / frames);
+    printf("shaded:      %.0f/frame, overdraw %.2f\n", sum.fragmentsShaded / frames, sum.overdraw / frames);
+
+    #ifdef F_ENABLE_PROFILING
+    // the history holds the last measured frames only
+    FProfileStatistics profile[64];
+    size_t numProfile = F_GetProfilerStatistics(profile, 64);
+
+    printf("\n%-24s %8s %8s %8s %8s %8s %8s  ms/frame\n", "scope", "min", "avg", "p50", "p95", "p99", "max");
+    for (size_t i = 0; i < numProfile && i < 64; ++i) {
+        const FProfileStatistics& p = profile[i];
+        printf("%*s%-*s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", int(p.depth * 2), "", 24 - int(p.depth * 2), p.name, p.min, p.avg, p.p50, p.p95, p.p99, p.max);
+    }
+    if (uint64_t lost = F_GetProfilerLostEvents())
+        printf("%llu events lost, collect more often or grow F_PROFILER_RING_SIZE\n", static_cast<unsigned long long>(lost));
+    #endif
+    return 0;
+}
+
+// the last directory of the path, existing ones are fine
+static bool MakeDirectory(const char* path)
+{
+#ifdef _WIN32
+    return _mkdir(path) == 0 || errno == EEXIST;
+#else
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+// golden images, color is stored as RGBA PAM and depth as PFM so that both open in common image viewers
+static bool WriteColorImage(const std::string& path, const FRenderTarget* rt)
+{
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    fprintf(fp, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", rt->width, rt->height);
+
+    const uint32_t* pixels = reinterpret_cast<const uint32_t*>(rt->pixels);
+    for (int i = 0; i < rt->width * rt->height; ++i) {
+        uint32_t p = pixels[i];
+        unsigned char rgba[4] = { uint8_t(p >> 16), uint8_t(p >> 8), uint8_t(p), uint8_t(p >> 24) };
+        fwrite(rgba, 1, 4, fp);
+    }
+
+    return fclose(fp) == 0;
+}
+
+static bool ReadColorImage(const std::string& path, int& width, int& height, std::vector<uint32_t>& pixels)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    bool ok = fscanf(fp, "P7 WIDTH %d HEIGHT %d DEPTH 4 MAXVAL 255 TUPLTYPE RGB_ALPHA ENDHDR", &width, &height) == 2 && fgetc(fp) == '\n' && width > 0 && height > 0;
+    if (ok) {
+        pixels.resize(size_t(width) * height);
+        for (uint32_t& p: pixels) {
+            unsigned char rgba[4];
+            if (fread(rgba, 1, 4, fp) != 4) {
+                ok = false;
+                break;
+            }
+            p = F_ARGB(uint32_t(rgba[3]), uint32_t(rgba[0]), uint32_t(rgba[1]), uint32_t(rgba[2]));
+        }
+    }
+
+    fclose(fp);
+    return ok;
+}
+
+// PFM rows go from the bottom up, the negative scale marks little-endian floats
+// the first sample of every pixel
+static std::vector<float> GetDepthPixels(const FRenderTarget* rt)
+{
+    const float* pixels = reinterpret_cast<const float*>(rt->pixels);
+
+    std::vector<float> ret(size_t(rt->width) * rt->height);
+    for (size_t i = 0; i < ret.size(); ++i)
+        ret[i] = pixels[i * rt->samples];
+    return ret;
+}
+
+static bool WriteDepthImage(const std::string& path, const FRenderTarget* rt)
+{
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    fprintf(fp, "Pf\n%d %d\n-1.0\n", rt->width, rt->height);
+
+    std::vector<float> pixels = GetDepthPixels(rt);
+    for (int y = rt->height - 1; y >= 0; --y)
+        fwrite(&pixels[size_t(y) * rt->width], sizeof(float), rt->width, fp);
+
+    return fclose(fp) == 0;
+}
+
+static bool ReadDepthImage(const std::string& path, int& width, int& height, std::vector<float>& pixels)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    float scale = 0.0F;
+    bool ok = fscanf(fp, "Pf %d %d %f", &width, &height, &scale) == 3 && fgetc(fp) == '\n' && width > 0 && height > 0 && scale < 0.0F;
+    if (ok) {
+        pixels.resize(size_t(width) * height);
+        for (int y = height - 1; y >= 0 && ok; --y)
+            ok = fread(&pixels[size_t(y) * width], sizeof(float), width, fp) == size_t(width);
+    }
+
+    fclose(fp);
+    return ok;
+}
+
+// dimmed reference where the images match, red scaled by the error (0..1) where they don't
+static bool WriteDiffImage(const std::string& path, int width, int height, const std::vector<uint8_t>& luma, const std::vector<float>& error)
+{
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    fprintf(fp, "P6\n%d %d\n255\n", width, height);
+
+    for (size_t i = 0; i < error.size(); ++i) {
+        uint8_t grey = luma[i] / 4;
+        unsigned char rgb[3] = { grey, grey, grey };
+
+        if (error[i] > 0.0F) {
+            rgb[0] = uint8_t(64.0F + 191.0F * (error[i] < 1.0F ? error[i] : 1.0F));
+            rgb[1] = 0;
+            rgb[2] = 0;
+        }
+        fwrite(rgb, 1, 3, fp);
+    }
+
+    return fclose(fp) == 0;
+}
+
+struct FImageDiff
+{
+    size_t mismatches = 0; // pixels with an error above the tolerance
+    float  maxError   = 0.0F;
+    double sumError   = 0.0;
+};
+
+static void PrintImageDiff(const char* what, const FImageDiff& diff, size_t numPixels)
+{
+    printf("    %s: %zu pixels (%.3f%%) differ, max error %g, mean error %g\n",
+           what, diff.mismatches, 100.0 * diff.mismatches / numPixels, diff.maxError, diff.sumError / numPixels);
+}
+
+// returns true when the scene matches its references, writes diff images next to them otherwise
+static bool CompareScene(const FBenchConfig& config, const std::string& base, const FRenderTarget* colorRT, const FRenderTarget* depthRT)
+{
+    int colorWidth = 0, colorHeight = 0, depthWidth = 0, depthHeight = 0;
+    std::vector<uint32_t> refColor;
+    std::vector<float>    refDepth;
+
+    if (!ReadColorImage(base + "_color.pam", colorWidth, colorHeight, refColor) || !ReadDepthImage(base + "_depth.pfm", depthWidth, depthHeight, refDepth)) {
+        printf("    missing or unreadable reference\n");
+        return false;
+    }
+
+    if (colorWidth != colorRT->width || colorHeight != colorRT->height || depthWidth != depthRT->width || depthHeight != depthRT->height) {
+        printf("    reference is %dx%d, rendered %dx%d\n", colorWidth, colorHeight, colorRT->width, colorRT->height);
+        return false;
+    }
+
+    size_t numPixels = refColor.size();
+
+    const uint32_t* color = reinterpret_cast<const uint32_t*>(colorRT->pixels);
+    std::vector<float> depth = GetDepthPixels(depthRT);
+
+    std::vector<uint8_t> luma(numPixels);
+    std::vector<float>   colorError(numPixels, 0.0F);
+    std::vector<float>   depthError(numPixels, 0.0F);
+
+    FImageDiff colorDiff;
+    FImageDiff depthDiff;
+
+    for (size_t i = 0; i < numPixels; ++i) {
+        uint32_t ref = refColor[i];
+        luma[i] = uint8_t((((ref >> 16) & 0xFF) + ((ref >> 8) & 0xFF) * 2 + (ref & 0xFF)) / 4);
+
+        // largest channel difference
+        int channelError = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            int d = std::abs(int((color[i] >> shift) & 0xFF) - int((ref >> shift) & 0xFF));
+            channelError = d > channelError ? d : channelError;
+        }
+
+        colorDiff.sumError += channelError;
+        colorDiff.maxError  = channelError > colorDiff.maxError ? channelError : colorDiff.maxError;
+        if (channelError > config.colorTolerance) {
+            colorDiff.mismatches++;
+            colorError[i] = channelError / 255.0F;
+        }
+
+        float d = std::fabs(depth[i] - refDepth[i]);
+        depthDiff.sumError += d;
+        depthDiff.maxError  = d > depthDiff.maxError ? d : depthDiff.maxError;
+        if (d > config.depthTolerance) {
+            depthDiff.mismatches++;
+            depthError[i] = d;
+        }
+    }
+
+    if (colorDiff.mismatches == 0 && depthDiff.mismatches == 0)
+        return true;
+
+    PrintImageDiff("color", colorDiff, numPixels);
+    PrintImageDiff("depth", depthDiff, numPixels);
+
+    // depth errors are tiny, scale them so that the largest one shows up bright
+    for (float& e: depthError)
+        e = depthDiff.maxError > 0.0F ? e / depthDiff.maxError : e;
+
+    if (!WriteDiffImage(base + "_color_diff.ppm", colorRT->width, colorRT->height, luma, colorError) ||
+        !WriteDiffImage(base + "_depth_diff.ppm", depthRT->width, depthRT->height, luma, depthError))
+        printf("    can't write diff images\n");
+
+    return false;
+}
+
+// returns true when the scene was recorded or matches its references
+static bool RunGoldenScene(const FBenchConfig& config, const FScene& scene, FRenderTarget* colorRT, FRenderTarget* depthRT, const FSceneResources& res)
+{
+    RenderScene(scene, colorRT->width, colorRT->height, colorRT, depthRT, res);
+    fglPresent();
+
+    // the color of multisampled scenes is resolved into colorRT
+    if (scene.msaa)
+        depthRT = colorRT == res.oddColorRT ? res.oddMsaaDepthRT : res.msaaDepthRT;
+
+    std::string base = std::string(config.goldenDir) + "/" + scene.name;
+
+    if (config.mode == BM_RECORD) {
+        bool ok = WriteColorImage(base + "_color.pam", colorRT) && WriteDepthImage(base + "_depth.pfm", depthRT);
+        printf("%-16s %s\n", scene.name, ok ? "recorded" : "can't write reference");
+        return ok;
+    }
+
+    printf("%s\n", scene.name);
+    bool ok = CompareScene(config, base, colorRT, depthRT);
+    printf("    %s\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static int RunGolden(const FBenchConfig& config, FRenderTarget* colorRT, FRenderTarget* depthRT, const FSceneResources& res)
+{
+    size_t numScenes = sizeof(g_goldenScenes) / sizeof(g_goldenScenes[0]) + sizeof(g_oddSizeScenes) / sizeof(g_oddSizeScenes[0]);
+    size_t failed    = 0;
+
+    if (config.mode == BM_RECORD && !MakeDirectory(config.goldenDir)) {
+        printf("can't create %s\n", config.goldenDir);
+        return 1;
+    }
+
+    for (const FScene& scene: g_goldenScenes)
+        failed += RunGoldenScene(config, scene, colorRT, depthRT, res) ? 0 : 1;
+
+    for (const FScene& scene: g_oddSizeScenes)
+        failed += RunGoldenScene(config, scene, res.oddColorRT, res.oddDepthRT, res) ? 0 : 1;
+
+    printf("%zu of %zu scenes %s\n", numScenes - failed, numScenes, config.mode == BM_RECORD ? "recorded" : "match");
+    return failed ? 1 : 0;
+}
+
+static void PrintUsage()
+{
+    printf("usage: FBench [options]\n"
+           "  -w <width>          render target width (640)\n"
+           "  -h <height>         render target height (480)\n"
+           "  -t <threads>        rasterizer and command recording threads, 0 for all cores (0)\n"
+           "benchmark:\n"
+           "  -n <cubes>          cubes in the field (9)\n"
+           "  -f <frames>         measured frames (500)\n"
+           "  -warmup <n>         frames rendered before measuring (20)\n"
+           "  -pipeline           overlap the vertex stage with rasterizing the previous frame,\n"
+           "                      stage times are then sampled from the latest finished frame\n"
+           "  -prepass            depth-only pass first, then a DF_EQUAL shading pass\n"
+           "  -nocull             draw back faces too, for overdraw\n"
+           "  -msaa               4x multisampled targets, resolved every frame\n"
+           "  -trace <file>       write a Chrome trace of the measured frames (F_ENABLE_PROFILING builds)\n"
+           "golden images:\n"
+           "  -record <dir>       render the golden scenes and store them as references,\n"
+           "                      the directory is created when missing\n"
+           "  -compare <dir>      render the golden scenes and compare them against the references,\n"
+           "                      diff images are written next to mismatching references\n"
+           "  -tolerance <n>      allowed color difference per channel (0)\n"
+           "  -dtolerance <x>     allowed depth difference (0)\n");
+}
+
+static bool ParseArguments(int argc, char* argv[], FBenchConfig& config)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char* arg   = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (!strcmp(arg, "-pipeline")) {
+            config.pipeline = true;
+            continue;
+        }
+        if (!strcmp(arg, "-prepass")) {
+            config.prepass = true;
+            continue;
+        }
+        if (!strcmp(arg, "-nocull")) {
+            config.cullMode = CM_NONE;
+            continue;
+        }
+        if (!strcmp(arg, "-msaa")) {
+            config.msaa = true;
+            continue;
+        }
+
+        if (!value)
+            return false;
+        ++i;
+
+        if      (!strcmp(arg, "-w"))          config.width          = atoi(value);
+        else if (!strcmp(arg, "-h"))          config.height         = atoi(value);
+        else if (!strcmp(arg, "-t"))          config.threads        = atoi(value);
+        else if (!strcmp(arg, "-n"))          config.cubes          = atoi(value);
+        else if (!strcmp(arg, "-f"))          config.frames         = atoi(value);
+        else if (!strcmp(arg, "-warmup"))     config.warmup         = atoi(value);
+        else if (!strcmp(arg, "-tolerance"))  config.colorTolerance = atoi(value);
+        else if (!strcmp(arg, "-dtolerance")) config.depthTolerance = static_cast<float>(atof(value));
+        else if (!strcmp(arg, "-trace"))      config.tracePath      = value;
+        else if (!strcmp(arg, "-record")) {
+            config.mode      = BM_RECORD;
+            config.goldenDir = value;
+        } else if (!strcmp(arg, "-compare")) {
+            config.mode      = BM_COMPARE;
+            config.goldenDir = value;
+        } else
+            return false;
+    }
+
+    return config.width > 0 && config.height > 0 && config.threads >= 0 && config.cubes >= 0 && config.frames > 0 && config.warmup >= 0 &&
+           config.colorTolerance >= 0 && config.depthTolerance >= 0.0F;
+}
+
+int main(int argc, char* argv[])
+{
+    FBenchConfig config;
+    if (!ParseArguments(argc, argv, config)) {
+        PrintUsage();
+        return 1;
+    }
+
+    FRenderTarget* colorRT[2] = {
+        FRenderTarget::Allocate(config.width, config.height, PF_ARGB8),
+        FRenderTarget::Allocate(config.width, config.height, PF_ARGB8)
+    };
+    FRenderTarget* depthRT = FRenderTarget::Allocate(config.width, config.height, PF_DEPTH);
+
+    FSceneResources res;
+    res.cubeVB      = FVertexBuffer::Allocate(cubeVertices, 24);
+    res.cubeIB      = FIndexBuffer::Allocate(cubeIndices, 36);
+    res.checkerTex  = CreateCheckerTexture();
+    res.patternTex  = CreatePatternTexture();
+    res.litPipeline = FPipeline::Allocate<FLitShader>();
+    res.msaaColorRT = FRenderTarget::Allocate(config.width, config.height, PF_ARGB8, F_MSAA_SAMPLES);
+    res.msaaDepthRT = FRenderTarget::Allocate(config.width, config.height, PF_DEPTH, F_MSAA_SAMPLES);
+    CreateSplitCube(res);
+
+    int oddWidth  = config.width > 3 ? config.width - 3 : config.width;
+    int oddHeight = config.height > 3 ? config.height - 3 : config.height;
+    res.oddColorRT     = FRenderTarget::Allocate(oddWidth, oddHeight, PF_ARGB8);
+    res.oddDepthRT     = FRenderTarget::Allocate(oddWidth, oddHeight, PF_DEPTH);
+    res.oddMsaaColorRT = FRenderTarget::Allocate(oddWidth, oddHeight, PF_ARGB8, F_MSAA_SAMPLES);
+    res.oddMsaaDepthRT = FRenderTarget::Allocate(oddWidth, oddHeight, PF_DEPTH, F_MSAA_SAMPLES);
+
+    fglSetThreadCount(config.threads);
+
+    FThreadPool recordPool;
+    recordPool.SetThreadCount(config.threads);
+    res.recordPool = &recordPool;
+
+    int result = config.mode == BM_BENCHMARK ? RunBenchmark(config, colorRT, depthRT, res) : RunGolden(config, colorRT[0], depthRT, res);
+
+    FRenderTarget::Release(colorRT[0]);
+    FRenderTarget::Release(colorRT[1]);
+    FRenderTarget::Release(depthRT);
+
+    FVertexBuffer::Release(res.cubeVB);
+    FIndexBuffer::Release(res.cubeIB);
+    FTexture::Release(res.checkerTex);
+    FTexture::Release(res.patternTex);
+    FPipeline::Release(res.litPipeline);
+    FRenderTarget::Release(res.msaaColorRT);
+    FRenderTarget::Release(res.msaaDepthRT);
+    FVertexBuffer::Release(res.splitPositionVB);
+    FVertexBuffer::Release(res.splitAttributeVB);
+    FVertexFormat::Release(res.splitFormat);
+    FRenderTarget::Release(res.oddColorRT);
+    FRenderTarget::Release(res.oddDepthRT);
+    FRenderTarget::Release(res.oddMsaaColorRT);
+    FRenderTarget::Release(res.oddMsaaDepthRT);
+
+    return result;
+}
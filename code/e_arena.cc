@@ -0,0 +1,77 @@
+#include "e_arena.hh"
+
+FArena::FArena(size_t size)
+    : chunkSize(size)
+{
+}
+
+FArena::~FArena()
+{
+    ReleaseChunks();
+}
+
+void* FArena::Allocate(size_t size, size_t alignment)
+{
+    for (;;) {
+        if (current < chunks.size()) {
+            FChunk& chunk = chunks[current];
+
+            uintptr_t base    = reinterpret_cast<uintptr_t>(chunk.data);
+            uintptr_t aligned = (base + offset + alignment - 1) & ~uintptr_t(alignment - 1);
+            size_t    end     = static_cast<size_t>(aligned - base) + size;
+
+            if (end <= chunk.size) {
+                offset = end;
+                return reinterpret_cast<void*>(aligned);
+            }
+
+            // the rest of this chunk is wasted, move on to the next one
+            if (current + 1 < chunks.size()) {
+                usedSize += chunk.size;
+                offset = 0;
+                ++current;
+                continue;
+            }
+        }
+
+        // out of chunks, add one large enough for this allocation
+        size_t newSize = size + alignment > chunkSize ? size + alignment : chunkSize;
+        chunks.push_back({ static_cast<uint8_t*>(::operator new(newSize)), newSize });
+
+        if (chunks.size() > 1) {
+            usedSize += chunks[current].size;
+            current = chunks.size() - 1;
+        }
+        offset = 0;
+    }
+}
+
+void FArena::Reset()
+{
+    size_t used = GetUsedSize();
+    highWater = used > highWater ? used : highWater;
+
+    size_t size = chunks.size() > 1 ? highWater : 0;
+    size = size > reserveSize ? size : reserveSize;
+
+    if (chunks.size() > 1 || (size > 0 && (chunks.empty() || chunks[0].size < size))) {
+        ReleaseChunks();
+        chunks.push_back({ static_cast<uint8_t*>(::operator new(size)), size });
+    }
+
+    current = 0;
+    offset = 0;
+    usedSize = 0;
+}
+
+void FArena::Reserve(size_t size)
+{
+    reserveSize = size;
+}
+
+void FArena::ReleaseChunks()
+{
+    for (FChunk& chunk: chunks)
+        ::operator delete(chunk.data);
+    chunks.clear();
+}
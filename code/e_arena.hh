@@ -0,0 +1,52 @@
+#pragma once
+
+#include "e_common.hh"
+
+#include <new>
+#include <vector>
+
+// Linear allocator: memory is handed out from large chunks and released all at once by Reset.
+// Not thread-safe, every thread that allocates needs its own arena.
+struct FArena
+{
+    explicit FArena(size_t chunkSize = 256 * 1024);
+    FArena(FArena&& other) = default;
+    ~FArena();
+
+    FArena(const FArena&) = delete;
+    FArena& operator=(const FArena&) = delete;
+
+    void* Allocate(size_t size, size_t alignment);
+
+    // uninitialized storage for count objects
+    template <typename T>
+    F_INLINE T* Allocate(size_t count = 1) { return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T))); }
+
+    // Forgets every allocation in O(1) and keeps the chunks. When the allocations since the previous reset
+    // spilled into several chunks, they are replaced by one chunk of the high-water size,
+    // so a steady workload ends up allocating from a single chunk without touching the heap.
+    void Reset();
+
+    // from the next reset on, the first chunk holds at least size bytes
+    void Reserve(size_t size);
+
+    size_t GetUsedSize() const { return usedSize + offset; } // since the last reset, including alignment padding
+    size_t GetHighWater() const { return highWater; }        // largest used size at a reset
+
+private:
+    struct FChunk
+    {
+        uint8_t* data;
+        size_t   size;
+    };
+
+    void ReleaseChunks();
+
+    std::vector<FChunk> chunks;
+    size_t              chunkSize;
+    size_t              current = 0;   // chunk being allocated from
+    size_t              offset = 0;    // in the current chunk
+    size_t              usedSize = 0;  // in the chunks before the current one
+    size_t              highWater = 0;
+    size_t              reserveSize = 0;
+};
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef _WIN32
@@ -9,6 +10,18 @@
 #define F_INLINE inline
 #endif
 
+// x86 SIMD paths, AVX2 code is compiled per function and selected at runtime
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define F_SIMD_SSE2 1
+#if defined(_MSC_VER)
+#define F_SIMD_AVX2 1
+#define F_TARGET_AVX2
+#elif defined(__GNUC__)
+#define F_SIMD_AVX2 1
+#define F_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
 #ifdef _MSC_VER
 #pragma warning(disable:4996)
 #define snprintf sprintf_s
@@ -0,0 +1,42 @@
+#include "e_cpu.hh"
+
+#if defined(F_SIMD_SSE2) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static uint32_t DetectCpuFeatures()
+{
+    uint32_t features = 0;
+
+#if defined(F_SIMD_SSE2)
+    features |= CPU_SSE2; // baseline for the build
+
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 7) {
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx     = (info[2] & (1 << 28)) != 0;
+        bool ymm     = osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+
+        __cpuidex(info, 7, 0);
+        if (ymm && (info[1] & (1 << 5)))
+            features |= CPU_AVX2;
+    }
+#elif defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        features |= CPU_AVX2;
+#endif
+#endif
+
+    return features;
+}
+
+uint32_t F_GetCpuFeatures()
+{
+    static const uint32_t features = DetectCpuFeatures();
+    return features;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "e_common.hh"
+
+enum ECpuFeature
+{
+    CPU_SSE2 = 1 << 0,
+    CPU_AVX2 = 1 << 1
+};
+
+// ECpuFeature bits supported by both the CPU and the OS, detected once
+uint32_t F_GetCpuFeatures();
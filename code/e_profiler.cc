@@ -2,5 +2,295 @@
 #include "e_profiler.hh"
 
 #ifdef F_ENABLE_PROFILING
-std::map<std::string, float> g_profilerStatistics = std::map<std::string, float>();
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+thread_local FProfilerThread* t_profilerThread = nullptr;
+
+struct FProfileEntry
+{
+    const char* name;
+    uint32_t    depth;
+    uint32_t    calls;
+    uint64_t    frameTicks;                 // of the frame being collected
+    float       history[F_PROFILER_HISTORY]; // ms per frame, ring
+};
+
+struct FCapturedEvent
+{
+    FProfileEvent event;
+    uint32_t      threadId;
+};
+
+struct FProfilerContext
+{
+    // Registered threads, never released because the collector may read a ring while its thread exits.
+    // Resizing the thread pool registers new threads, so this only grows with the number of threads ever started.
+    std::mutex                       threadMutex;
+    std::vector<FProfilerThread*>    threads;
+
+    // tick rate, measured against the steady clock from the first registration on
+    uint64_t                                 startTicks = 0;
+    std::chrono::steady_clock::time_point    startTime;
+
+    // collector state
+    std::mutex                       mutex;
+    std::vector<FProfileEntry>       entries;
+    uint64_t                         numFrames = 0;
+    uint64_t                         lostEvents = 0;
+    std::vector<FProfileEvent>       scratch;
+
+    bool                             capturing = false;
+    std::vector<FCapturedEvent>      capture;
+} g_profiler;
+
+FProfilerThread* F_RegisterProfilerThread()
+{
+    FProfilerThread* thread = new FProfilerThread;
+    thread->writeIndex.store(0, std::memory_order_relaxed);
+    thread->readIndex = 0;
+    thread->depth     = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(g_profiler.threadMutex);
+
+        if (g_profiler.threads.empty()) {
+            g_profiler.startTicks = F_ProfilerTicks();
+            g_profiler.startTime  = std::chrono::steady_clock::now();
+        }
+
+        thread->id = static_cast<uint32_t>(g_profiler.threads.size());
+        snprintf(thread->name, sizeof(thread->name), "Thread %u", thread->id);
+
+        g_profiler.threads.push_back(thread);
+    }
+
+    t_profilerThread = thread;
+    return thread;
+}
+
+void F_ProfilerSetThreadName(const char* name)
+{
+    FProfilerThread* thread = t_profilerThread ? t_profilerThread : F_RegisterProfilerThread();
+
+    std::lock_guard<std::mutex> lock(g_profiler.threadMutex);
+    snprintf(thread->name, sizeof(thread->name), "%s", name);
+}
+
+static double GetTicksPerMs()
+{
+    // both clocks are read back to back, the error shrinks as the run gets longer
+    double ms    = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - g_profiler.startTime).count();
+    double ticks = static_cast<double>(F_ProfilerTicks() - g_profiler.startTicks);
+
+    if (ms < 1.0)
+        return 1e6; // too early to tell, assume a 1 GHz counter
+    return ticks / ms;
+}
+
+static FProfileEntry& FindEntry(const char* name, uint32_t depth)
+{
+    // literals of different translation units may not be merged, addresses are only the fast path
+    for (FProfileEntry& entry: g_profiler.entries) {
+        if (entry.name == name || !strcmp(entry.name, name)) {
+            entry.depth = depth < entry.depth ? depth : entry.depth;
+            return entry;
+        }
+    }
+
+    FProfileEntry entry;
+    entry.name       = name;
+    entry.depth      = depth;
+    entry.calls      = 0;
+    entry.frameTicks = 0;
+    std::fill(entry.history, entry.history + F_PROFILER_HISTORY, 0.0F);
+
+    g_profiler.entries.push_back(entry);
+    return g_profiler.entries.back();
+}
+
+// copies the events published since the last collection, drops the ones the owner may have overwritten meanwhile
+static void DrainThread(FProfilerThread* thread, std::vector<FProfileEvent>& out)
+{
+    out.clear();
+
+    uint64_t write = thread->writeIndex.load(std::memory_order_acquire);
+    uint64_t first = thread->readIndex;
+    if (write - first > F_PROFILER_RING_SIZE) {
+        g_profiler.lostEvents += write - first - F_PROFILER_RING_SIZE;
+        first = write - F_PROFILER_RING_SIZE;
+    }
+
+    for (uint64_t i = first; i < write; ++i)
+        out.push_back(thread->events[i & (F_PROFILER_RING_SIZE - 1)]);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t overwritten = thread->writeIndex.load(std::memory_order_relaxed);
+    if (overwritten > first + F_PROFILER_RING_SIZE) {
+        size_t numLost = static_cast<size_t>(std::min<uint64_t>(overwritten - first - F_PROFILER_RING_SIZE, out.size()));
+        g_profiler.lostEvents += numLost;
+        out.erase(out.begin(), out.begin() + numLost);
+    }
+
+    thread->readIndex = write;
+}
+
+void F_ProfilerEndFrame()
+{
+    std::vector<FProfilerThread*> threads;
+    {
+        std::lock_guard<std::mutex> lock(g_profiler.threadMutex);
+        threads = g_profiler.threads;
+    }
+
+    std::lock_guard<std::mutex> lock(g_profiler.mutex);
+
+    for (FProfileEntry& entry: g_profiler.entries) {
+        entry.calls      = 0;
+        entry.frameTicks = 0;
+    }
+
+    for (FProfilerThread* thread: threads) {
+        DrainThread(thread, g_profiler.scratch);
+
+        for (const FProfileEvent& event: g_profiler.scratch) {
+            FProfileEntry& entry = FindEntry(event.name, event.depth);
+            entry.calls++;
+            entry.frameTicks += event.end - event.begin;
+
+            if (g_profiler.capturing)
+                g_profiler.capture.push_back({ event, thread->id });
+        }
+    }
+
+    double msPerTick = 1.0 / GetTicksPerMs();
+    size_t slot      = g_profiler.numFrames % F_PROFILER_HISTORY;
+
+    for (FProfileEntry& entry: g_profiler.entries)
+        entry.history[slot] = static_cast<float>(entry.frameTicks * msPerTick);
+
+    g_profiler.numFrames++;
+}
+
+void F_ProfilerResetStatistics()
+{
+    std::vector<FProfilerThread*> threads;
+    {
+        std::lock_guard<std::mutex> lock(g_profiler.threadMutex);
+        threads = g_profiler.threads;
+    }
+
+    std::lock_guard<std::mutex> lock(g_profiler.mutex);
+
+    for (FProfilerThread* thread: threads)
+        DrainThread(thread, g_profiler.scratch);
+
+    g_profiler.entries.clear();
+    g_profiler.numFrames = 0;
+}
+
+size_t F_GetProfilerStatistics(FProfileStatistics* stats, size_t maxCount)
+{
+    std::lock_guard<std::mutex> lock(g_profiler.mutex);
+
+    size_t numFrames = static_cast<size_t>(std::min<uint64_t>(g_profiler.numFrames, F_PROFILER_HISTORY));
+    size_t lastSlot  = static_cast<size_t>((g_profiler.numFrames + F_PROFILER_HISTORY - 1) % F_PROFILER_HISTORY);
+
+    float sorted[F_PROFILER_HISTORY];
+
+    for (size_t i = 0; i < g_profiler.entries.size() && i < maxCount && numFrames > 0; ++i) {
+        const FProfileEntry& entry = g_profiler.entries[i];
+
+        // the ring is full once history frames passed, before that the first numFrames slots are used
+        std::copy(entry.history, entry.history + numFrames, sorted);
+        std::sort(sorted, sorted + numFrames);
+
+        float sum = 0.0F;
+        for (size_t f = 0; f < numFrames; ++f)
+            sum += sorted[f];
+
+        FProfileStatistics& s = stats[i];
+        s.name  = entry.name;
+        s.depth = entry.depth;
+        s.calls = entry.calls;
+        s.last  = entry.history[lastSlot];
+        s.min   = sorted[0];
+        s.avg   = sum / numFrames;
+        s.max   = sorted[numFrames - 1];
+        s.p50   = sorted[(numFrames - 1) * 50 / 100];
+        s.p95   = sorted[(numFrames - 1) * 95 / 100];
+        s.p99   = sorted[(numFrames - 1) * 99 / 100];
+    }
+
+    return numFrames > 0 ? g_profiler.entries.size() : 0;
+}
+
+uint64_t F_GetProfilerLostEvents()
+{
+    std::lock_guard<std::mutex> lock(g_profiler.mutex);
+    return g_profiler.lostEvents;
+}
+
+void F_ProfilerBeginCapture()
+{
+    std::lock_guard<std::mutex> lock(g_profiler.mutex);
+    g_profiler.capturing = true;
+    g_profiler.capture.clear();
+}
+
+// names are identifiers or thread names set by the engine, only quotes and backslashes need escaping
+static void WriteJsonString(FILE* fp, const char* str)
+{
+    fputc('"', fp);
+    for (const char* c = str; *c; ++c) {
+        if (*c == '"' || *c == '\\')
+            fputc('\\', fp);
+        fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
+
+bool F_ProfilerEndCapture(const char* path)
+{
+    std::vector<FCapturedEvent> capture;
+    {
+        std::lock_guard<std::mutex> lock(g_profiler.mutex);
+        g_profiler.capturing = false;
+        capture.swap(g_profiler.capture);
+    }
+
+    FILE* fp = fopen(path, "wb");
+    if (!fp)
+        return false;
+
+    double usPerTick = 1000.0 / GetTicksPerMs();
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+
+    bool first = true;
+    {
+        std::lock_guard<std::mutex> lock(g_profiler.threadMutex);
+        for (const FProfilerThread* thread: g_profiler.threads) {
+            fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", thread->id);
+            WriteJsonString(fp, thread->name);
+            fprintf(fp, "}}");
+            first = false;
+        }
+    }
+
+    // complete events, the viewer nests them by time
+    for (const FCapturedEvent& ce: capture) {
+        fprintf(fp, "%s{\"name\":", first ? "" : ",\n");
+        WriteJsonString(fp, ce.event.name);
+        fprintf(fp, ",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                ce.threadId, (ce.event.begin - g_profiler.startTicks) * usPerTick, (ce.event.end - ce.event.begin) * usPerTick);
+        first = false;
+    }
+
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0;
+}
 #endif
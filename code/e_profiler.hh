@@ -6,38 +6,124 @@
 //#define F_ENABLE_PROFILING 1
 #ifdef F_ENABLE_PROFILING
 
+#include <atomic>
 #include <chrono>
-#include <map>
-#include <string>
 
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
+#if defined(F_SIMD_SSE2)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
 #endif
 
-extern std::map<std::string, float> g_profilerStatistics;
+// Scopes are recorded into a ring buffer owned by the thread that runs them, without locks or allocations.
+// F_ProfilerEndFrame drains every ring and turns the events into per-frame statistics and, while capturing, into a trace.
+
+// events a thread can record between two collections, older ones are overwritten, power of two
+#define F_PROFILER_RING_SIZE 8192
+
+// frames the statistics are computed over
+#define F_PROFILER_HISTORY 256
+
+struct FProfileEvent
+{
+    const char* name;  // string literal
+    uint64_t    begin; // ticks
+    uint64_t    end;
+    uint32_t    depth; // nesting level on the recording thread
+};
+
+struct FProfilerThread
+{
+    FProfileEvent         events[F_PROFILER_RING_SIZE];
+    std::atomic<uint64_t> writeIndex; // published by the owning thread
+    uint64_t              readIndex;  // next event to collect, collector only
+    uint32_t              depth;      // scopes open right now, owning thread only
+    uint32_t              id;         // in registration order
+    char                  name[32];
+};
+
+extern thread_local FProfilerThread* t_profilerThread;
+
+FProfilerThread* F_RegisterProfilerThread();
+
+// TSC on x86, steady clock nanoseconds elsewhere, converted to time at collection
+static F_INLINE uint64_t F_ProfilerTicks()
+{
+#if defined(F_SIMD_SSE2)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
 
 struct FNamedProfiler
 {
-    std::chrono::high_resolution_clock::time_point tmStart;
-    const char* name;
+    FProfilerThread* thread;
+    const char*      name;
+    uint64_t         begin;
 
-    F_INLINE FNamedProfiler(const char* profName)
-        : name(profName)
+    F_INLINE explicit FNamedProfiler(const char* profName)
+        : thread(t_profilerThread ? t_profilerThread : F_RegisterProfilerThread()), name(profName)
     {
-        tmStart = std::chrono::high_resolution_clock::now();
+        thread->depth++;
+        begin = F_ProfilerTicks();
     }
 
     F_INLINE ~FNamedProfiler()
     {
-        auto tmEnd = std::chrono::high_resolution_clock::now();
-        float msCount = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(tmEnd - tmStart).count();
+        uint64_t end   = F_ProfilerTicks();
+        uint64_t index = thread->writeIndex.load(std::memory_order_relaxed);
+
+        FProfileEvent& event = thread->events[index & (F_PROFILER_RING_SIZE - 1)];
+        event.name  = name;
+        event.begin = begin;
+        event.end   = end;
+        event.depth = --thread->depth;
 
-        g_profilerStatistics[name] += msCount;
+        thread->writeIndex.store(index + 1, std::memory_order_release);
     }
 };
 
+// shown in traces, threads are called "Thread <id>" otherwise
+void F_ProfilerSetThreadName(const char* name);
+
+// Collects the events recorded since the previous call on every thread and closes a frame of statistics.
+// Call it from one thread, scopes still running on other threads count towards the frame they end in.
+void F_ProfilerEndFrame();
+
+// drops the collected history and the events not collected yet, e.g. after warming up
+void F_ProfilerResetStatistics();
+
+// milliseconds a scope took per frame, summed over its calls and threads
+struct FProfileStatistics
+{
+    const char* name;
+    uint32_t    depth;  // smallest nesting level the scope was seen at
+    uint32_t    calls;  // in the last frame
+    float       last;
+    float       min;    // over the history
+    float       avg;
+    float       max;
+    float       p50;
+    float       p95;
+    float       p99;
+};
+
+// in order of first appearance, returns the number of scopes even when it's more than maxCount
+size_t F_GetProfilerStatistics(FProfileStatistics* stats, size_t maxCount);
+
+// events overwritten before they could be collected, since the start
+uint64_t F_GetProfilerLostEvents();
+
+// Chrome trace capture (chrome://tracing, Perfetto), every event collected in between is written as JSON
+void F_ProfilerBeginCapture();
+bool F_ProfilerEndCapture(const char* path);
+
 #define F_NAMED_PROFILE(X) FNamedProfiler prof_##X(#X)
+#define F_PROFILE_THREAD_NAME(N) F_ProfilerSetThreadName(N)
 #else
 #define F_NAMED_PROFILE(X)
+#define F_PROFILE_THREAD_NAME(N)
 #endif
@@ -0,0 +1,157 @@
+#include "e_threads.hh"
+#include "e_profiler.hh"
+
+#include <cstdio>
+
+FThreadPool::FThreadPool()
+    : nextIndex(0)
+{
+}
+
+FThreadPool::~FThreadPool()
+{
+    StopWorkers();
+}
+
+void FThreadPool::SetThreadCount(uint32_t count)
+{
+    if (count == 0) {
+        count = std::thread::hardware_concurrency();
+        if (count == 0)
+            count = 1;
+    }
+
+    if (count == GetThreadCount())
+        return;
+
+    StopWorkers();
+
+    for (uint32_t i = 1; i < count; ++i)
+        workers.emplace_back(&FThreadPool::WorkerMain, this, i);
+}
+
+void FThreadPool::ParallelFor(size_t count, const TJob& fn)
+{
+    if (count == 0)
+        return;
+
+    if (workers.empty() || count == 1) {
+        for (size_t i = 0; i < count; ++i)
+            fn(i, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        jobCount = count;
+        nextIndex.store(0, std::memory_order_relaxed);
+        busyWorkers = static_cast<uint32_t>(workers.size());
+        ++generation;
+    }
+    wakeCondition.notify_all();
+
+    RunJobs(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this] { return busyWorkers == 0; });
+    job = nullptr;
+}
+
+void FThreadPool::WorkerMain(uint32_t threadIndex)
+{
+#ifdef F_ENABLE_PROFILING
+    char name[32];
+    snprintf(name, sizeof(name), "Worker %u", threadIndex);
+    F_PROFILE_THREAD_NAME(name);
+#endif
+
+    uint64_t seenGeneration = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping)
+                return;
+            seenGeneration = generation;
+        }
+
+        RunJobs(threadIndex);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --busyWorkers;
+        }
+        doneCondition.notify_one();
+    }
+}
+
+void FThreadPool::RunJobs(uint32_t threadIndex)
+{
+    for (;;) {
+        size_t index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+        if (index >= jobCount)
+            break;
+        (*job)(index, threadIndex);
+    }
+}
+
+void FThreadPool::StopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+
+    for (std::thread& worker : workers)
+        worker.join();
+
+    workers.clear();
+    stopping = false;
+}
+
+FTaskThread::~FTaskThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCondition.notify_one();
+
+    if (thread.joinable())
+        thread.join();
+}
+
+void FTaskThread::Enqueue(TTask task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+
+        if (!thread.joinable())
+            thread = std::thread(&FTaskThread::ThreadMain, this);
+    }
+    wakeCondition.notify_one();
+}
+
+void FTaskThread::ThreadMain()
+{
+    F_PROFILE_THREAD_NAME("Task Thread");
+
+    for (;;) {
+        TTask task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCondition.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        task();
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "e_common.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed-size worker pool, the calling thread always takes part in the work
+struct FThreadPool
+{
+    typedef std::function<void(size_t index, uint32_t threadIndex)> TJob;
+
+    FThreadPool();
+    ~FThreadPool();
+
+    // total number of threads including the calling one, 0 means hardware concurrency
+    void     SetThreadCount(uint32_t count);
+    uint32_t GetThreadCount() const { return static_cast<uint32_t>(workers.size()) + 1; }
+
+    // runs job(index, threadIndex) for every index in [0, count) and waits for completion,
+    // threadIndex is in [0, GetThreadCount()) and is 0 for the calling thread
+    void ParallelFor(size_t count, const TJob& job);
+
+private:
+    void WorkerMain(uint32_t threadIndex);
+    void RunJobs(uint32_t threadIndex);
+    void StopWorkers();
+
+    std::vector<std::thread> workers;
+
+    std::mutex               mutex;
+    std::condition_variable  wakeCondition;
+    std::condition_variable  doneCondition;
+
+    const TJob*              job = nullptr;
+    size_t                   jobCount = 0;
+    std::atomic<size_t>      nextIndex;
+    uint32_t                 busyWorkers = 0;
+    uint64_t                 generation = 0;
+    bool                     stopping = false;
+};
+
+// single background thread running queued tasks one at a time in submission order
+struct FTaskThread
+{
+    typedef std::function<void()> TTask;
+
+    FTaskThread() = default;
+    ~FTaskThread(); // runs the remaining tasks before returning
+
+    // the thread is started by the first task
+    void Enqueue(TTask task);
+
+private:
+    void ThreadMain();
+
+    std::thread              thread;
+
+    std::mutex               mutex;
+    std::condition_variable  wakeCondition;
+
+    std::deque<TTask>        tasks;
+    bool                     stopping = false;
+};
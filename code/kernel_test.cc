@@ -0,0 +1,342 @@
+#include "r_coverage.hh"
+#include "r_transform.hh"
+#include "r_sampler.hh"
+#include "r_blend.hh"
+#include "e_cpu.hh"
+
+#define GLM_FORCE_PURE
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Runs every variant of the SIMD kernels the CPU supports on random input and compares it with the scalar
+// reference. All variants are meant to give bit-identical results, so any difference is a failure.
+
+typedef std::mt19937 TRandom;
+
+static F_INLINE int RandomInt(TRandom& rng, int lo, int hi) // [lo, hi]
+{
+    return std::uniform_int_distribution<int>(lo, hi)(rng);
+}
+
+static F_INLINE float RandomFloat(TRandom& rng, float lo, float hi)
+{
+    return std::uniform_real_distribution<float>(lo, hi)(rng);
+}
+
+template<typename TFn>
+struct FKernelVariant
+{
+    const char* name;
+    uint32_t    features; // ECpuFeature bits it needs
+    TFn         fn;
+};
+
+// block coverage, random triangles around random blocks: some just around the block for partial masks,
+// some spanning the guard band so that the clamped edge values come into play, and some with vertices
+// on whole pixels so that edges run exactly through pixels and the fill convention decides
+static const FKernelVariant<TBlockCoverageFn> g_coverageVariants[] = {
+    { "scalar", 0,        ComputeBlockCoverage_Scalar },
+#ifdef F_SIMD_SSE2
+    { "SSE2",   CPU_SSE2, ComputeBlockCoverage_SSE2   },
+#endif
+#ifdef F_SIMD_AVX2
+    { "AVX2",   CPU_AVX2, ComputeBlockCoverage_AVX2   },
+#endif
+};
+
+static size_t TestBlockCoverage(TBlockCoverageFn fn, TRandom& rng)
+{
+    const int     numCases = 200000;
+    const int     ranges[] = { 8 * 16, 64 * 16, 4096 * 16 }; // 28.4 distance of the vertices from the block
+    const int64_t limit    = int64_t(1) << 30;                // ClampEdgeValue
+
+    size_t mismatches = 0;
+
+    for (int i = 0; i < numCases; ++i) {
+        int bx    = RandomInt(rng, 0, 255) * 8;
+        int by    = RandomInt(rng, 0, 255) * 8;
+        int range = ranges[i % 3];
+        int snap  = (i / 3) % 2 ? ~15 : ~0;
+
+        int X[3];
+        int Y[3];
+        for (int v = 0; v < 3; ++v) {
+            X[v] = (bx * 16 + RandomInt(rng, -range, range)) & snap;
+            Y[v] = (by * 16 + RandomInt(rng, -range, range)) & snap;
+        }
+
+        int CY[3];
+        int FDX[3];
+        int FDY[3];
+
+        // half-edge functions with the fill convention like SetupTriangle, evaluated at the block
+        for (int e = 0; e < 3; ++e) {
+            int n  = (e + 1) % 3;
+            int DX = X[e] - X[n];
+            int DY = Y[e] - Y[n];
+
+            int64_t C = int64_t(DY) * X[e] - int64_t(DX) * Y[e];
+            if (DY < 0 || (DY == 0 && DX > 0))
+                C++;
+
+            int64_t E = C + int64_t(DX) * (by * 16) - int64_t(DY) * (bx * 16);
+            CY[e]  = static_cast<int>(E > limit ? limit : (E < -limit ? -limit : E));
+            FDX[e] = DX * 16;
+            FDY[e] = DY * 16;
+        }
+
+        if (fn(CY, FDX, FDY) != ComputeBlockCoverage_Scalar(CY, FDX, FDY))
+            mismatches++;
+    }
+
+    return mismatches;
+}
+
+// vertex transform, batches of random length and stride through random perspective matrices, positions around
+// the camera so that the batches mix visible vertices with ones outside the guard band and behind the near plane
+static const FKernelVariant<TTransformVerticesFn> g_transformVariants[] = {
+    { "scalar", 0,        TransformVertices_Scalar },
+#ifdef F_SIMD_SSE2
+    { "SSE2",   CPU_SSE2, TransformVertices_SSE2   },
+#endif
+#ifdef F_SIMD_AVX2
+    { "AVX2",   CPU_AVX2, TransformVertices_AVX2   },
+#endif
+};
+
+struct FTransformOutput
+{
+    std::vector<float>    clip[4];
+    std::vector<int>      screen[2];
+    std::vector<float>    depth;
+    std::vector<uint32_t> outcode;
+
+    FTransformedVertices Bind(size_t count)
+    {
+        for (std::vector<float>& c: clip)
+            c.assign(count, 0.0F);
+        for (std::vector<int>& s: screen)
+            s.assign(count, 0);
+        depth.assign(count, 0.0F);
+        outcode.assign(count, 0);
+
+        return { clip[0].data(), clip[1].data(), clip[2].data(), clip[3].data(), screen[0].data(), screen[1].data(), depth.data(), outcode.data() };
+    }
+};
+
+static F_INLINE bool SameBits(float a, float b)
+{
+    return std::memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+static size_t TestTransformVertices(TTransformVerticesFn fn, TRandom& rng)
+{
+    const int    numBatches = 5000;
+    const size_t strides[]  = { 3, 5, 8 }; // positions alone, and with texcoords and normals
+
+    FTransformOutput ref;
+    FTransformOutput out;
+    size_t mismatches = 0;
+
+    for (int i = 0; i < numBatches; ++i) {
+        size_t count  = static_cast<size_t>(RandomInt(rng, 0, 37));
+        size_t stride = strides[i % 3];
+
+        std::vector<float> positions(count * stride);
+        for (float& p: positions)
+            p = RandomFloat(rng, -12.0F, 12.0F);
+
+        glm::vec3 angles(RandomFloat(rng, 0.0F, 6.3F), RandomFloat(rng, 0.0F, 6.3F), RandomFloat(rng, 0.0F, 6.3F));
+        glm::mat4 mvp = glm::perspective(RandomFloat(rng, 0.5F, 1.5F), RandomFloat(rng, 0.5F, 2.0F), 0.1F, 50.0F)
+                      * glm::translate(glm::vec3(0.0F, 0.0F, -RandomFloat(rng, 0.0F, 20.0F)))
+                      * glm::mat4_cast(glm::quat(angles));
+
+        TDrawMatrix matrix;
+        std::memcpy(matrix, glm::value_ptr(mvp), sizeof(matrix));
+
+        FViewport vp = SetupViewport(RandomInt(rng, 1, 2048), RandomInt(rng, 1, 2048));
+
+        TransformVertices_Scalar(matrix, vp, positions.data(), stride, count, ref.Bind(count));
+        fn(matrix, vp, positions.data(), stride, count, out.Bind(count));
+
+        for (size_t v = 0; v < count; ++v) {
+            bool same = out.outcode[v] == ref.outcode[v];
+            for (int c = 0; c < 4; ++c)
+                same = same && SameBits(out.clip[c][v], ref.clip[c][v]);
+
+            // the rest is only defined for vertices that need no clipping
+            if ((ref.outcode[v] & CP_MUST_CLIP) == 0) {
+                same = same && out.screen[0][v] == ref.screen[0][v] && out.screen[1][v] == ref.screen[1][v];
+                same = same && SameBits(out.depth[v], ref.depth[v]);
+            }
+
+            mismatches += same ? 0 : 1;
+        }
+    }
+
+    return mismatches;
+}
+
+// bilinear filter, random footprints and weights, with black and white texels and the weights 0 and 255
+// mixed in so that the channels hit both ends of the 8.8 fixed point range
+static const FKernelVariant<TFilterBilinearFn> g_bilinearVariants[] = {
+    { "scalar", 0,        FilterBilinear_Scalar },
+#ifdef F_SIMD_SSE2
+    { "SSE2",   CPU_SSE2, FilterBilinear_SSE2   },
+#endif
+#ifdef F_SIMD_AVX2
+    { "AVX2",   CPU_AVX2, FilterBilinear_AVX2   },
+#endif
+};
+
+static F_INLINE uint32_t RandomTexel(TRandom& rng)
+{
+    switch (RandomInt(rng, 0, 3)) {
+    case 0:  return 0x00000000;
+    case 1:  return 0xFFFFFFFF;
+    default: return static_cast<uint32_t>(rng());
+    }
+}
+
+static F_INLINE uint32_t RandomWeight(TRandom& rng)
+{
+    switch (RandomInt(rng, 0, 3)) {
+    case 0:  return 0;
+    case 1:  return 255;
+    default: return static_cast<uint32_t>(RandomInt(rng, 0, 255));
+    }
+}
+
+static size_t TestFilterBilinear(TFilterBilinearFn fn, TRandom& rng)
+{
+    const int numCases = 200000;
+
+    size_t mismatches = 0;
+
+    for (int i = 0; i < numCases; ++i) {
+        FBilinearQuad quad;
+        for (int p = 0; p < 4; ++p) {
+            quad.t00[p] = RandomTexel(rng);
+            quad.t10[p] = RandomTexel(rng);
+            quad.t01[p] = RandomTexel(rng);
+            quad.t11[p] = RandomTexel(rng);
+            quad.fx[p]  = RandomWeight(rng);
+            quad.fy[p]  = RandomWeight(rng);
+        }
+
+        uint32_t ref[4];
+        uint32_t out[4];
+        FilterBilinear_Scalar(quad, ref);
+        fn(quad, out);
+
+        for (int p = 0; p < 4; ++p)
+            mismatches += out[p] == ref[p] ? 0 : 1;
+    }
+
+    return mismatches;
+}
+
+// blending, spans of random pixels through random blend states covering every factor and op, transparent and
+// opaque alpha mixed in like with the bilinear filter
+static const FKernelVariant<TBlendPixelsFn> g_blendVariants[] = {
+    { "scalar", 0,        BlendPixels_Scalar },
+#ifdef F_SIMD_SSE2
+    { "SSE2",   CPU_SSE2, BlendPixels_SSE2   },
+#endif
+#ifdef F_SIMD_AVX2
+    { "AVX2",   CPU_AVX2, BlendPixels_AVX2   },
+#endif
+};
+
+static F_INLINE uint32_t RandomPixel(TRandom& rng)
+{
+    uint32_t rgb = static_cast<uint32_t>(rng()) & 0x00FFFFFF;
+
+    switch (RandomInt(rng, 0, 3)) {
+    case 0:  return rgb;
+    case 1:  return rgb | 0xFF000000;
+    default: return RandomTexel(rng);
+    }
+}
+
+static size_t TestBlendPixels(TBlendPixelsFn fn, TRandom& rng)
+{
+    const int numSpans = 20000;
+
+    std::vector<uint32_t> src;
+    std::vector<uint32_t> ref;
+    std::vector<uint32_t> out;
+    size_t mismatches = 0;
+
+    for (int i = 0; i < numSpans; ++i) {
+        FBlendState state;
+        state.enable = RandomInt(rng, 0, 15) != 0;
+        state.src    = static_cast<EBlendFactor>(RandomInt(rng, BF_ZERO, BF_INV_DST_ALPHA));
+        state.dst    = static_cast<EBlendFactor>(RandomInt(rng, BF_ZERO, BF_INV_DST_ALPHA));
+        state.op     = static_cast<EBlendOp>(RandomInt(rng, BO_ADD, BO_MAX));
+
+        size_t length = static_cast<size_t>(RandomInt(rng, 1, 16)) * 4;
+
+        src.resize(length);
+        ref.resize(length);
+        for (size_t p = 0; p < length; ++p) {
+            src[p] = RandomPixel(rng);
+            ref[p] = RandomPixel(rng);
+        }
+        out = ref;
+
+        for (size_t p = 0; p < length; p += 4) {
+            BlendPixels_Scalar(state, &src[p], &ref[p]);
+            fn(state, &src[p], &out[p]);
+        }
+
+        for (size_t p = 0; p < length; ++p)
+            mismatches += out[p] == ref[p] ? 0 : 1;
+    }
+
+    return mismatches;
+}
+
+// returns the number of failed variants
+template<typename TFn, size_t N>
+static size_t RunVariants(const char* kernel, const FKernelVariant<TFn> (&variants)[N], size_t (*test)(TFn, TRandom&))
+{
+    uint32_t features = F_GetCpuFeatures();
+    size_t   failed   = 0;
+
+    for (const FKernelVariant<TFn>& variant: variants) {
+        if ((features & variant.features) != variant.features) {
+            printf("%-10s %-6s skipped, not supported by the CPU\n", kernel, variant.name);
+            continue;
+        }
+
+        // every variant sees the same cases
+        TRandom rng(1);
+        size_t mismatches = test(variant.fn, rng);
+
+        if (mismatches)
+            printf("%-10s %-6s FAILED, %zu cases differ from the scalar reference\n", kernel, variant.name, mismatches);
+        else
+            printf("%-10s %-6s ok\n", kernel, variant.name);
+
+        failed += mismatches ? 1 : 0;
+    }
+
+    return failed;
+}
+
+int main()
+{
+    size_t failed = 0;
+    failed += RunVariants("coverage", g_coverageVariants, TestBlockCoverage);
+    failed += RunVariants("transform", g_transformVariants, TestTransformVertices);
+    failed += RunVariants("bilinear", g_bilinearVariants, TestFilterBilinear);
+    failed += RunVariants("blend", g_blendVariants, TestBlendPixels);
+
+    return failed ? 1 : 0;
+}
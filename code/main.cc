@@ -13,22 +13,57 @@
 #define WIDTH 640
 #define HEIGHT 480
 
-// render targets and buffers
-FRenderTarget* g_colorRT;
+// render targets and buffers, color is double-buffered so that a frame is shown while the next one rasterizes
+FRenderTarget* g_colorRT[2];
 FRenderTarget* g_depthRT;
 
 FVertexBuffer* g_cubeVB;
 FIndexBuffer*  g_cubeIB;
 
+FTexture*      g_checkerTex;
+
+FCommandBuffer* g_frameCB;
+
+// 4x4 checker, 2x2 texel squares
+static FTexture* CreateCheckerTexture()
+{
+    const uint32_t grey  = F_ARGB(255u, 127u, 127u, 127u);
+    const uint32_t white = F_ARGB(255u, 255u, 255u, 255u);
+
+    const uint32_t texels[4 * 4] = {
+        grey,  grey,  white, white,
+        grey,  grey,  white, white,
+        white, white, grey,  grey,
+        white, white, grey,  grey
+    };
+
+    return FTexture::Allocate(4, 4, texels);
+}
+
 // game loop
 glm::vec3 g_cameraPos;
 
-void F_GameStep()
+// pipeline statistics overlay, toggled with P
+bool g_showStatistics = false;
+
+// frame presented by the previous step
+TFrameHandle   g_pendingFrame;
+FRenderTarget* g_pendingRT;
+
+// returns the target to show, the one finished by the previous step
+FRenderTarget* F_GameStep()
 {
     static float time = 0.5F;
     time += 0.005F;
-    
-    fglSetRenderTarget(g_colorRT);
+
+    static uint32_t frameIndex = 0;
+    FRenderTarget* colorRT = g_colorRT[frameIndex++ & 1];
+
+    TFrameHandle frame;
+
+    fglBeginCommandBuffer(g_frameCB);
+
+    fglSetRenderTarget(colorRT);
     fglSetDepthStencilTarget(g_depthRT);
 
     fglClear(0x00FFFF00, 1.0F);
@@ -59,26 +94,68 @@ void F_GameStep()
                 fglSetMatrix(DM_MODELVIEW, glm::value_ptr(modelview[i]));
                 fglSetVertexBuffer(g_cubeVB);
                 fglSetIndexBuffer(g_cubeIB);
+                fglSetTexture(g_checkerTex);
                 fglDrawIndexed(0, 36);
             }
         }
-        fglPresent();
+        fglEndCommandBuffer();
+
+        fglSubmit(&g_frameCB, 1);
+        frame = fglPresentAsync();
     }
 
+    // presenting waited for the previous frame, this frame keeps rasterizing meanwhile
+    FRenderTarget* displayRT = g_pendingRT;
+    fglWaitFrame(g_pendingFrame);
+
+    g_pendingFrame = frame;
+    g_pendingRT    = colorRT;
+
+    if (!displayRT)
+        return nullptr;
+
     char buf[512];
     snprintf(buf, 512, "Friskhet! (%ix%i)", WIDTH, HEIGHT);
-    fglDrawDebugText(g_colorRT, buf, 0, 0);
+    fglDrawDebugText(displayRT, buf, 0, 0);
 
-    #ifdef F_ENABLE_PROFILING
     int py = 8;
-    for (const auto& itr: g_profilerStatistics) {
-        snprintf(buf, 512, "%s: %.3fms", itr.first.c_str(), itr.second);
-        fglDrawDebugText(g_colorRT, buf, 0, py);
+    if (g_showStatistics) {
+        FPipelineStatistics stats;
+        fglGetPipelineStatistics(&stats);
+        py = fglDrawPipelineStatistics(displayRT, stats, 0, py);
+    }
+
+    #ifdef F_ENABLE_PROFILING
+    F_ProfilerEndFrame();
+
+    FProfileStatistics stats[32];
+    size_t numStats = F_GetProfilerStatistics(stats, 32);
+
+    for (size_t i = 0; i < numStats && i < 32; ++i) {
+        const FProfileStatistics& s = stats[i];
+        snprintf(buf, 512, "%*s%s: %.3fms (avg %.3f, p95 %.3f, max %.3f)", int(s.depth * 2), "", s.name, s.last, s.avg, s.p95, s.max);
+        fglDrawDebugText(displayRT, buf, 0, py);
         py += 8;
     }
-    g_profilerStatistics.clear();
     #endif
+
+    return displayRT;
+}
+
+#ifdef F_ENABLE_PROFILING
+// first press starts a capture, the second one writes it
+static void ToggleTraceCapture()
+{
+    static bool capturing = false;
+
+    if (!capturing)
+        F_ProfilerBeginCapture();
+    else if (!F_ProfilerEndCapture("friskhet_trace.json"))
+        SDL_Log("can't write friskhet_trace.json");
+
+    capturing = !capturing;
 }
+#endif
 
 // main loop
 int main(int argc, char *argv[])
@@ -90,6 +167,8 @@ int main(int argc, char *argv[])
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
         return 1;
 
+    F_PROFILE_THREAD_NAME("Main");
+
     // window and renderer
     win = SDL_CreateWindow("Friskhet!", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIDTH, HEIGHT, 0);
     renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
@@ -97,12 +176,19 @@ int main(int argc, char *argv[])
     // create surface
     rsurface = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
 
-    g_colorRT = FRenderTarget::Allocate(WIDTH, HEIGHT, PF_ARGB8);
-    g_depthRT = FRenderTarget::Allocate(WIDTH, HEIGHT, PF_DEPTH);
+    g_colorRT[0] = FRenderTarget::Allocate(WIDTH, HEIGHT, PF_ARGB8);
+    g_colorRT[1] = FRenderTarget::Allocate(WIDTH, HEIGHT, PF_ARGB8);
+    g_depthRT    = FRenderTarget::Allocate(WIDTH, HEIGHT, PF_DEPTH);
+
+    fglSetThreadCount(0);
 
     g_cubeVB  = FVertexBuffer::Allocate(cubeVertices, 24);
     g_cubeIB  = FIndexBuffer::Allocate(cubeIndices, 36);
 
+    g_checkerTex = CreateCheckerTexture();
+
+    g_frameCB = FCommandBuffer::Allocate();
+
     // main loop
     bool running = true;
     while (running) {
@@ -130,6 +216,10 @@ int main(int argc, char *argv[])
                     if (ev.key.keysym.sym == SDLK_s) g_cameraPos.y -= 1.0F;
                     if (ev.key.keysym.sym == SDLK_a) g_cameraPos.x += 1.0F;
                     if (ev.key.keysym.sym == SDLK_d) g_cameraPos.x -= 1.0F;
+                    if (ev.key.keysym.sym == SDLK_p) g_showStatistics = !g_showStatistics;
+                    #ifdef F_ENABLE_PROFILING
+                    if (ev.key.keysym.sym == SDLK_t) ToggleTraceCapture();
+                    #endif
                 break;
 
                 case SDL_MOUSEMOTION:
@@ -154,13 +244,13 @@ int main(int argc, char *argv[])
         }
 
         // process game
-        F_GameStep();
+        FRenderTarget* displayRT = F_GameStep();
 
         // update screen contents
-        {
+        if (displayRT) {
             //F_NAMED_PROFILE(Present);
 
-            SDL_UpdateTexture(rsurface, NULL, g_colorRT->pixels, WIDTH * sizeof(uint32_t));
+            SDL_UpdateTexture(rsurface, NULL, displayRT->pixels, WIDTH * sizeof(uint32_t));
 
             // clear the screen
             SDL_RenderClear(renderer);
@@ -169,12 +259,19 @@ int main(int argc, char *argv[])
         }
     }
 
-    FRenderTarget::Release(g_colorRT);
+    fglWaitFrame(g_pendingFrame);
+
+    FRenderTarget::Release(g_colorRT[0]);
+    FRenderTarget::Release(g_colorRT[1]);
     FRenderTarget::Release(g_depthRT);
 
     FVertexBuffer::Release(g_cubeVB);
     FIndexBuffer::Release(g_cubeIB);
 
+    FTexture::Release(g_checkerTex);
+
+    FCommandBuffer::Release(g_frameCB);
+
     SDL_DestroyTexture(rsurface);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(win);
@@ -0,0 +1,198 @@
+#include "r_blend.hh"
+#include "e_cpu.hh"
+
+#ifdef F_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef F_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+// a * f / 255 rounded, exact for every pair of bytes
+static F_INLINE uint32_t MulChannel(uint32_t a, uint32_t f)
+{
+    uint32_t t = a * f + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static F_INLINE uint32_t BlendFactor(EBlendFactor factor, uint32_t src, uint32_t dst, int shift)
+{
+    switch (factor) {
+    case BF_ZERO:          return 0;
+    case BF_ONE:           return 255;
+    case BF_SRC_COLOR:     return (src >> shift) & 0xFF;
+    case BF_INV_SRC_COLOR: return 255 - ((src >> shift) & 0xFF);
+    case BF_SRC_ALPHA:     return src >> 24;
+    case BF_INV_SRC_ALPHA: return 255 - (src >> 24);
+    case BF_DST_COLOR:     return (dst >> shift) & 0xFF;
+    case BF_INV_DST_COLOR: return 255 - ((dst >> shift) & 0xFF);
+    case BF_DST_ALPHA:     return dst >> 24;
+    case BF_INV_DST_ALPHA: return 255 - (dst >> 24);
+    default:               return 0;
+    }
+}
+
+void BlendPixels_Scalar(const FBlendState& state, const uint32_t src[4], uint32_t dst[4])
+{
+    for (int i = 0; i < 4; ++i) {
+        uint32_t ret = 0;
+
+        for (int shift = 0; shift < 32; shift += 8) {
+            uint32_t s = (src[i] >> shift) & 0xFF;
+            uint32_t d = (dst[i] >> shift) & 0xFF;
+
+            uint32_t ts = MulChannel(s, BlendFactor(state.src, src[i], dst[i], shift));
+            uint32_t td = MulChannel(d, BlendFactor(state.dst, src[i], dst[i], shift));
+
+            uint32_t c;
+            switch (state.op) {
+            case BO_ADD:              c = ts + td > 255 ? 255 : ts + td; break;
+            case BO_SUBTRACT:         c = ts > td ? ts - td : 0; break;
+            case BO_REVERSE_SUBTRACT: c = td > ts ? td - ts : 0; break;
+            case BO_MIN:              c = s < d ? s : d; break;
+            default:                  c = s > d ? s : d; break;
+            }
+
+            ret |= c << shift;
+        }
+
+        dst[i] = ret;
+    }
+}
+
+#ifdef F_SIMD_SSE2
+// 16-bit lanes holding the four channels of two pixels
+static F_INLINE __m128i BroadcastAlpha_SSE2(__m128i x)
+{
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xFF), 0xFF);
+}
+
+static F_INLINE __m128i Factor_SSE2(EBlendFactor factor, __m128i s, __m128i d)
+{
+    const __m128i full = _mm_set1_epi16(255);
+
+    switch (factor) {
+    case BF_ZERO:          return _mm_setzero_si128();
+    case BF_ONE:           return full;
+    case BF_SRC_COLOR:     return s;
+    case BF_INV_SRC_COLOR: return _mm_sub_epi16(full, s);
+    case BF_SRC_ALPHA:     return BroadcastAlpha_SSE2(s);
+    case BF_INV_SRC_ALPHA: return _mm_sub_epi16(full, BroadcastAlpha_SSE2(s));
+    case BF_DST_COLOR:     return d;
+    case BF_INV_DST_COLOR: return _mm_sub_epi16(full, d);
+    case BF_DST_ALPHA:     return BroadcastAlpha_SSE2(d);
+    case BF_INV_DST_ALPHA: return _mm_sub_epi16(full, BroadcastAlpha_SSE2(d));
+    default:               return _mm_setzero_si128();
+    }
+}
+
+// products are at most 255 * 255, so the wrapped 16-bit arithmetic stays exact
+static F_INLINE __m128i MulChannel_SSE2(__m128i a, __m128i f)
+{
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, f), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// results above 255 saturate when packed
+static F_INLINE __m128i Blend16_SSE2(const FBlendState& state, __m128i s, __m128i d)
+{
+    if (state.op == BO_MIN)
+        return _mm_min_epi16(s, d);
+    if (state.op == BO_MAX)
+        return _mm_max_epi16(s, d);
+
+    __m128i ts = MulChannel_SSE2(s, Factor_SSE2(state.src, s, d));
+    __m128i td = MulChannel_SSE2(d, Factor_SSE2(state.dst, s, d));
+
+    switch (state.op) {
+    case BO_ADD:      return _mm_add_epi16(ts, td);
+    case BO_SUBTRACT: return _mm_subs_epu16(ts, td);
+    default:          return _mm_subs_epu16(td, ts);
+    }
+}
+
+void BlendPixels_SSE2(const FBlendState& state, const uint32_t src[4], uint32_t dst[4])
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst));
+
+    __m128i lo = Blend16_SSE2(state, _mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+    __m128i hi = Blend16_SSE2(state, _mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(lo, hi));
+}
+#endif
+
+#ifdef F_SIMD_AVX2
+// 16-bit lanes holding the four channels of all four pixels
+F_TARGET_AVX2 static F_INLINE __m256i BroadcastAlpha_AVX2(__m256i x)
+{
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, 0xFF), 0xFF);
+}
+
+F_TARGET_AVX2 static F_INLINE __m256i Factor_AVX2(EBlendFactor factor, __m256i s, __m256i d)
+{
+    const __m256i full = _mm256_set1_epi16(255);
+
+    switch (factor) {
+    case BF_ZERO:          return _mm256_setzero_si256();
+    case BF_ONE:           return full;
+    case BF_SRC_COLOR:     return s;
+    case BF_INV_SRC_COLOR: return _mm256_sub_epi16(full, s);
+    case BF_SRC_ALPHA:     return BroadcastAlpha_AVX2(s);
+    case BF_INV_SRC_ALPHA: return _mm256_sub_epi16(full, BroadcastAlpha_AVX2(s));
+    case BF_DST_COLOR:     return d;
+    case BF_INV_DST_COLOR: return _mm256_sub_epi16(full, d);
+    case BF_DST_ALPHA:     return BroadcastAlpha_AVX2(d);
+    case BF_INV_DST_ALPHA: return _mm256_sub_epi16(full, BroadcastAlpha_AVX2(d));
+    default:               return _mm256_setzero_si256();
+    }
+}
+
+F_TARGET_AVX2 static F_INLINE __m256i MulChannel_AVX2(__m256i a, __m256i f)
+{
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(a, f), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+F_TARGET_AVX2 void BlendPixels_AVX2(const FBlendState& state, const uint32_t src[4], uint32_t dst[4])
+{
+    __m256i s = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+    __m256i d = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(dst)));
+
+    __m256i ret;
+    if (state.op == BO_MIN) {
+        ret = _mm256_min_epi16(s, d);
+    } else if (state.op == BO_MAX) {
+        ret = _mm256_max_epi16(s, d);
+    } else {
+        __m256i ts = MulChannel_AVX2(s, Factor_AVX2(state.src, s, d));
+        __m256i td = MulChannel_AVX2(d, Factor_AVX2(state.dst, s, d));
+
+        ret = state.op == BO_ADD      ? _mm256_add_epi16(ts, td) :
+              state.op == BO_SUBTRACT ? _mm256_subs_epu16(ts, td) : _mm256_subs_epu16(td, ts);
+    }
+
+    // packing works within 128-bit lanes, gather the low halves of both
+    ret = _mm256_permute4x64_epi64(_mm256_packus_epi16(ret, ret), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm256_castsi256_si128(ret));
+}
+#endif
+
+TBlendPixelsFn F_SelectBlendPixels()
+{
+    uint32_t features = F_GetCpuFeatures();
+    (void)features;
+
+#ifdef F_SIMD_AVX2
+    if (features & CPU_AVX2)
+        return BlendPixels_AVX2;
+#endif
+#ifdef F_SIMD_SSE2
+    if (features & CPU_SSE2)
+        return BlendPixels_SSE2;
+#endif
+    return BlendPixels_Scalar;
+}
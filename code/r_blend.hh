@@ -0,0 +1,19 @@
+#pragma once
+
+#include "r_draw.hh"
+
+// Blending of four ARGB8 pixels per call in 8-bit fixed point. Both terms are scaled by their 0..255 factors
+// and divided by 255 with rounding as (t + 128 + ((t + 128) >> 8)) >> 8, then combined with saturation.
+// All implementations give bit-identical results.
+typedef void (*TBlendPixelsFn)(const FBlendState& state, const uint32_t src[4], uint32_t dst[4]); // dst receives the result
+
+void BlendPixels_Scalar(const FBlendState& state, const uint32_t src[4], uint32_t dst[4]);
+#ifdef F_SIMD_SSE2
+void BlendPixels_SSE2(const FBlendState& state, const uint32_t src[4], uint32_t dst[4]);
+#endif
+#ifdef F_SIMD_AVX2
+void BlendPixels_AVX2(const FBlendState& state, const uint32_t src[4], uint32_t dst[4]);
+#endif
+
+// best implementation for the running CPU, the scalar one is the fallback
+TBlendPixelsFn F_SelectBlendPixels();
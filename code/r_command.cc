@@ -0,0 +1,117 @@
+#include "r_command.hh"
+
+#include <cstring>
+
+// buffer recorded by the calling thread, every thread records independently
+static thread_local FCommandBuffer* g_recordingBuffer = nullptr;
+
+FCommandBuffer* FCommandBuffer::Allocate()
+{
+    FCommandBuffer* cb = new FCommandBuffer;
+    cb->commands = nullptr;
+    cb->size = 0;
+    cb->capacity = 0;
+    cb->data = nullptr;
+    cb->dataSize = 0;
+    cb->dataCapacity = 0;
+    return cb;
+}
+
+void FCommandBuffer::Release(FCommandBuffer* cb)
+{
+    delete [] cb->commands;
+    delete [] cb->data;
+    delete cb;
+}
+
+FCommand* RecordCommand(ECommandType type)
+{
+    FCommandBuffer* cb = g_recordingBuffer;
+    if (!cb)
+        return nullptr;
+
+    if (cb->size == cb->capacity) {
+        size_t capacity = cb->capacity ? cb->capacity * 2 : 64;
+
+        FCommand* commands = new FCommand[capacity];
+        if (cb->size)
+            std::memcpy(commands, cb->commands, cb->size * sizeof(FCommand));
+
+        delete [] cb->commands;
+        cb->commands = commands;
+        cb->capacity = capacity;
+    }
+
+    FCommand* cmd = &cb->commands[cb->size++];
+    cmd->type = type;
+    return cmd;
+}
+
+size_t RecordCommandData(const void* data, size_t size)
+{
+    FCommandBuffer* cb = g_recordingBuffer;
+
+    if (cb->dataSize + size > cb->dataCapacity) {
+        size_t capacity = cb->dataCapacity ? cb->dataCapacity * 2 : 256;
+        while (capacity < cb->dataSize + size)
+            capacity *= 2;
+
+        uint8_t* buffer = new uint8_t[capacity];
+        if (cb->dataSize)
+            std::memcpy(buffer, cb->data, cb->dataSize);
+
+        delete [] cb->data;
+        cb->data = buffer;
+        cb->dataCapacity = capacity;
+    }
+
+    size_t offset = cb->dataSize;
+    if (size)
+        std::memcpy(cb->data + offset, data, size);
+    cb->dataSize += size;
+    return offset;
+}
+
+void fglBeginCommandBuffer(FCommandBuffer* cb)
+{
+    cb->size = 0;
+    cb->dataSize = 0;
+    g_recordingBuffer = cb;
+}
+
+void fglEndCommandBuffer()
+{
+    g_recordingBuffer = nullptr;
+}
+
+void fglSubmit(FCommandBuffer* const* cbs, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const FCommandBuffer* cb = cbs[i];
+
+        for (size_t c = 0; c < cb->size; ++c) {
+            const FCommand& cmd = cb->commands[c];
+
+            switch (cmd.type) {
+            case CT_SET_RENDER_TARGET:        fglSetRenderTarget(cmd.renderTarget); break;
+            case CT_SET_DEPTH_STENCIL_TARGET: fglSetDepthStencilTarget(cmd.renderTarget); break;
+            case CT_SET_RESOLVE_TARGET:       fglSetResolveTarget(cmd.renderTarget); break;
+            case CT_CLEAR:                    fglClear(cmd.clear.color, cmd.clear.depth); break;
+            case CT_SET_MATRIX:               fglSetMatrix(cmd.setMatrix.matrix, const_cast<float*>(cmd.setMatrix.value)); break;
+            case CT_SET_CULL_MODE:            fglSetCullMode(cmd.cullMode); break;
+            case CT_SET_DEPTH_STATE:          fglSetDepthState(cmd.depthState); break;
+            case CT_SET_COLOR_WRITE:          fglSetColorWrite(cmd.colorWrite); break;
+            case CT_SET_BLEND_STATE:          fglSetBlendState(cmd.blendState); break;
+            case CT_SET_PIPELINE:             fglSetPipeline(cmd.pipeline); break;
+            case CT_SET_SHADER_CONSTANTS:     fglSetShaderConstants(cb->data + cmd.shaderConstants.offset, cmd.shaderConstants.size); break;
+            case CT_SET_TEXTURE:              fglSetTexture(cmd.texture); break;
+            case CT_SET_SAMPLER_STATE:        fglSetSamplerState(cmd.samplerState); break;
+            case CT_SET_VERTEX_FORMAT:        fglSetVertexFormat(cmd.vertexFormat); break;
+            case CT_SET_VERTEX_STREAM:        fglSetVertexStream(cmd.vertexStream.stream, cmd.vertexStream.buffer); break;
+            case CT_SET_INDEX_BUFFER:         fglSetIndexBuffer(cmd.indexBuffer); break;
+            case CT_DRAW:                     fglDraw(cmd.draw.offset, cmd.draw.count); break;
+            case CT_DRAW_INDEXED:             fglDrawIndexed(cmd.draw.offset, cmd.draw.count); break;
+            }
+        }
+    }
+}
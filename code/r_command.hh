@@ -0,0 +1,57 @@
+#pragma once
+
+#include "r_draw.hh"
+
+enum ECommandType
+{
+    CT_SET_RENDER_TARGET = 0,
+    CT_SET_DEPTH_STENCIL_TARGET,
+    CT_SET_RESOLVE_TARGET,
+    CT_CLEAR,
+    CT_SET_MATRIX,
+    CT_SET_CULL_MODE,
+    CT_SET_DEPTH_STATE,
+    CT_SET_COLOR_WRITE,
+    CT_SET_BLEND_STATE,
+    CT_SET_PIPELINE,
+    CT_SET_SHADER_CONSTANTS,
+    CT_SET_TEXTURE,
+    CT_SET_SAMPLER_STATE,
+    CT_SET_VERTEX_FORMAT,
+    CT_SET_VERTEX_STREAM,
+    CT_SET_INDEX_BUFFER,
+    CT_DRAW,
+    CT_DRAW_INDEXED
+};
+
+// one recorded fgl call with its arguments
+struct FCommand
+{
+    ECommandType type;
+
+    union
+    {
+        FRenderTarget* renderTarget;
+        struct { uint32_t color; float depth; } clear;
+        struct { EDrawMatrix matrix; TDrawMatrix value; } setMatrix;
+        ECullMode      cullMode;
+        FDepthState    depthState;
+        bool           colorWrite;
+        FBlendState    blendState;
+        const FPipeline* pipeline;
+        struct { size_t offset; size_t size; } shaderConstants; // copied into the buffer's data
+        FTexture*      texture;
+        FSamplerState  samplerState;
+        const FVertexFormat* vertexFormat;
+        struct { uint32_t stream; FVertexBuffer* buffer; } vertexStream;
+        FIndexBuffer*  indexBuffer;
+        struct { size_t offset; size_t count; } draw;
+    };
+};
+
+// Appends a command to the buffer the calling thread is recording, nullptr when it isn't recording.
+// Every recordable fgl call starts with it and returns early when it gets a command to fill.
+FCommand* RecordCommand(ECommandType type);
+
+// copies arguments passed by pointer into the buffer being recorded, returns their offset in it
+size_t RecordCommandData(const void* data, size_t size);
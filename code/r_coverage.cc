@@ -0,0 +1,118 @@
+#include "r_coverage.hh"
+#include "e_cpu.hh"
+
+#ifdef F_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef F_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+uint64_t ComputeBlockCoverage_Scalar(const int CY[3], const int FDX[3], const int FDY[3])
+{
+    uint64_t mask = 0;
+
+    int CY1 = CY[0];
+    int CY2 = CY[1];
+    int CY3 = CY[2];
+
+    for (int iy = 0; iy < 8; ++iy) {
+        int CX1 = CY1;
+        int CX2 = CY2;
+        int CX3 = CY3;
+
+        for (int ix = 0; ix < 8; ++ix) {
+            if (CX1 > 0 && CX2 > 0 && CX3 > 0)
+                mask |= uint64_t(1) << (iy * 8 + ix);
+
+            CX1 -= FDY[0];
+            CX2 -= FDY[1];
+            CX3 -= FDY[2];
+        }
+
+        CY1 += FDX[0];
+        CY2 += FDX[1];
+        CY3 += FDX[2];
+    }
+
+    return mask;
+}
+
+#ifdef F_SIMD_SSE2
+uint64_t ComputeBlockCoverage_SSE2(const int CY[3], const int FDX[3], const int FDY[3])
+{
+    // columns 0..3 and 4..7 of the row, SSE2 has no 32-bit mullo so the lane offsets are built by hand
+    __m128i lo[3];
+    __m128i hi[3];
+    __m128i dy[3];
+
+    for (int e = 0; e < 3; ++e) {
+        lo[e] = _mm_setr_epi32(CY[e], CY[e] - FDY[e], CY[e] - 2 * FDY[e], CY[e] - 3 * FDY[e]);
+        hi[e] = _mm_sub_epi32(lo[e], _mm_set1_epi32(4 * FDY[e]));
+        dy[e] = _mm_set1_epi32(FDX[e]);
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t mask = 0;
+
+    for (int iy = 0; iy < 8; ++iy) {
+        __m128i inLo = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(lo[0], zero), _mm_cmpgt_epi32(lo[1], zero)), _mm_cmpgt_epi32(lo[2], zero));
+        __m128i inHi = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(hi[0], zero), _mm_cmpgt_epi32(hi[1], zero)), _mm_cmpgt_epi32(hi[2], zero));
+
+        uint64_t row = _mm_movemask_ps(_mm_castsi128_ps(inLo)) | (_mm_movemask_ps(_mm_castsi128_ps(inHi)) << 4);
+        mask |= row << (iy * 8);
+
+        for (int e = 0; e < 3; ++e) {
+            lo[e] = _mm_add_epi32(lo[e], dy[e]);
+            hi[e] = _mm_add_epi32(hi[e], dy[e]);
+        }
+    }
+
+    return mask;
+}
+#endif
+
+#ifdef F_SIMD_AVX2
+F_TARGET_AVX2 uint64_t ComputeBlockCoverage_AVX2(const int CY[3], const int FDX[3], const int FDY[3])
+{
+    // one whole row per register
+    const __m256i columns = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256i cx[3];
+    __m256i dy[3];
+
+    for (int e = 0; e < 3; ++e) {
+        cx[e] = _mm256_sub_epi32(_mm256_set1_epi32(CY[e]), _mm256_mullo_epi32(columns, _mm256_set1_epi32(FDY[e])));
+        dy[e] = _mm256_set1_epi32(FDX[e]);
+    }
+
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t mask = 0;
+
+    for (int iy = 0; iy < 8; ++iy) {
+        __m256i in = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(cx[0], zero), _mm256_cmpgt_epi32(cx[1], zero)), _mm256_cmpgt_epi32(cx[2], zero));
+        mask |= uint64_t(_mm256_movemask_ps(_mm256_castsi256_ps(in))) << (iy * 8);
+
+        for (int e = 0; e < 3; ++e)
+            cx[e] = _mm256_add_epi32(cx[e], dy[e]);
+    }
+
+    return mask;
+}
+#endif
+
+TBlockCoverageFn F_SelectBlockCoverage()
+{
+    uint32_t features = F_GetCpuFeatures();
+    (void)features;
+
+#ifdef F_SIMD_AVX2
+    if (features & CPU_AVX2)
+        return ComputeBlockCoverage_AVX2;
+#endif
+#ifdef F_SIMD_SSE2
+    if (features & CPU_SSE2)
+        return ComputeBlockCoverage_SSE2;
+#endif
+    return ComputeBlockCoverage_Scalar;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "e_common.hh"
+
+// Coverage of an 8x8 block by three half-space edge functions.
+// CY holds the edge values at the block's top-left pixel, a pixel is covered when all three are > 0.
+// Stepping one pixel right subtracts FDY, stepping one row down adds FDX.
+// Bit (row * 8 + column) of the result is set for covered pixels.
+typedef uint64_t (*TBlockCoverageFn)(const int CY[3], const int FDX[3], const int FDY[3]);
+
+uint64_t ComputeBlockCoverage_Scalar(const int CY[3], const int FDX[3], const int FDY[3]);
+#ifdef F_SIMD_SSE2
+uint64_t ComputeBlockCoverage_SSE2(const int CY[3], const int FDX[3], const int FDY[3]);
+#endif
+#ifdef F_SIMD_AVX2
+uint64_t ComputeBlockCoverage_AVX2(const int CY[3], const int FDX[3], const int FDY[3]);
+#endif
+
+// best implementation for the running CPU, the scalar one is the fallback
+TBlockCoverageFn F_SelectBlockCoverage();
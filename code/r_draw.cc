@@ -1,43 +1,30 @@
 
 #include "r_draw.hh"
 #include "r_debugfont.hh"
+#include "r_shader.hh"
+#include "r_transform.hh"
+#include "r_texture.hh"
+#include "r_command.hh"
 #include "e_profiler.hh"
+#include "e_threads.hh"
+#include "e_arena.hh"
 
-#include <vector>
-
-// defines and config
-//#define F_RASTERIZER_VIZ_COVERAGE
-#ifdef F_RASTERIZER_VIZ_COVERAGE
-#define FULL_COVERED_COLOR 0x000000FF
-#define PARTIALLY_COVERED_COLOR 0x00FF0000
+#ifdef F_SIMD_SSE2
+#include <emmintrin.h>
 #endif
 
-// utils
-static F_INLINE int imin(int x, int y) { return y + ((x - y) & ((x - y) >> (sizeof(int) * CHAR_BIT - 1))); }
-static F_INLINE int imax(int x, int y) { return x - ((x - y) & ((x - y) >> (sizeof(int) * CHAR_BIT - 1))); }
-
-static F_INLINE int imin3(int x, int y, int z) { return imin(x, imin(y, z)); }
-static F_INLINE int imax3(int x, int y, int z) { return imax(x, imax(y, z)); }
-
-static F_INLINE int iclamp(int x, int a, int b) { return imin(imax(x, a), b); }
-
-static F_INLINE int iround(float x) { return static_cast<int>(x); }
-//static F_INLINE int iround(float x)
-//{
-//    int t;
-//    __asm
-//    {
-//        fld x
-//        fistp t
-//    }
-//    return t;
-//}
-
-static F_INLINE float fround(int x) { return static_cast<float>(x); }
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
 
-// pixel formats
-typedef uint32_t TPixelARGB8;
-typedef float    TPixelDepth;
+// defines and config
+// screen tile size for binning, must be a multiple of the 8x8 rasterizer block
+#define F_TILE_SIZE 64
 
 size_t g_MapPixelFormatSize[] = {
     sizeof(TPixelARGB8),
@@ -120,6 +107,11 @@ static F_INLINE FPoint4D operator+(const FPoint4D& pt, float f)
     return { pt.x + f, pt.y + f, pt.z + f, pt.w + f };
 }
 
+static F_INLINE FPoint4D operator-(const FPoint4D& pt0, const FPoint4D& pt1)
+{
+    return { pt0.x - pt1.x, pt0.y - pt1.y, pt0.z - pt1.z, pt0.w - pt1.w };
+}
+
 static F_INLINE FPoint4D operator*(const FPoint4D& pt0, const FPoint4D& pt1)
 {
     return { pt0.x * pt1.x, pt0.y * pt1.y, pt0.z * pt1.z, pt0.w * pt1.w };
@@ -168,9 +160,8 @@ struct IPoint2D
 
 struct SSPoint2D // screen-space point
 {
-    IPoint2D position;
+    IPoint2D position; // 28.4 fixed point, integer coordinates are pixel centers
     float    depth;
-    FPoint3D texcoord; // (U/Z, V/Z, 1/Z)
 };
 
 struct SSTri // screen-space triangle
@@ -178,246 +169,649 @@ struct SSTri // screen-space triangle
     SSPoint2D v0;
     SSPoint2D v1;
     SSPoint2D v2;
+
+    const float*     varyings;    // of v0, v1 and v2 one after another, packed in the frame's triangle storage
+    uint32_t         numVaryings; // per vertex, the ones of the pipeline or none for depth-only draws
+    const FPipeline* pipeline;
+    const void*      constants;
+    const FTexture*  texture;
+    FSamplerState    sampler;
+    FDepthState      depthState;
+    bool             colorWrite;
+    FBlendState      blend;
 };
 
-// rasterizer
-static F_INLINE FPoint3D CalculateBarycentricCoords(const SSTri& tri, const IPoint2D& pt)
+// built-in shaders
+struct FTexturedShader
 {
-    int d = ((tri.v1.position.y - tri.v2.position.y) * (tri.v0.position.x - tri.v2.position.x) + (tri.v2.position.x - tri.v1.position.x) * (tri.v0.position.y - tri.v2.position.y));
-    float denom = 1.0F / d;
+    static const uint32_t NumVaryings = 2;
+    static const bool     Textured    = true;
 
-    FPoint3D ret;
+    static F_INLINE void ShadeVertex(const FVertexInput& in, const void*, float* varyings)
+    {
+        varyings[0] = in.attributes[VS_TEXCOORD0][0];
+        varyings[1] = in.attributes[VS_TEXCOORD0][1];
+    }
+
+    static F_INLINE void ShadePixels(const FPixelShaderInput& in, uint32_t colors[4])
+    {
+        SampleQuad(*in.sampler, in.varyings[0], in.varyings[1], colors);
+    }
+};
+
+// what the textured shader gives without a texture, minus the sampling
+struct FUntexturedShader
+{
+    static const uint32_t NumVaryings = 0;
+    static const bool     Textured    = false;
+
+    static F_INLINE void ShadeVertex(const FVertexInput&, const void*, float*) {}
 
-    ret.x = ((tri.v1.position.y - tri.v2.position.y) * (pt.x - tri.v2.position.x) + (tri.v2.position.x - tri.v1.position.x) * (pt.y - tri.v2.position.y)) * denom;
-    ret.y = ((tri.v2.position.y - tri.v0.position.y) * (pt.x - tri.v2.position.x) + (tri.v0.position.x - tri.v2.position.x) * (pt.y - tri.v2.position.y)) * denom;
-    ret.z = (1.0F) - ret.x - ret.y;
+    static F_INLINE void ShadePixels(const FPixelShaderInput&, uint32_t colors[4])
+    {
+        for (int i = 0; i < 4; ++i)
+            colors[i] = F_ARGB(255u, 255u, 255u, 255u);
+    }
+};
+
+static const FPipeline* g_texturedPipeline   = FPipeline::Allocate<FTexturedShader>();
+static const FPipeline* g_untexturedPipeline = FPipeline::Allocate<FUntexturedShader>();
+
+void FPipeline::Release(FPipeline* pipeline)
+{
+    delete pipeline;
+}
 
+// rasterizer
+static const TBlockCoverageFn g_computeBlockCoverage = F_SelectBlockCoverage();
+static const TBlendPixelsFn   g_blendPixels = F_SelectBlendPixels();
+
+// computes the attribute plane through the three vertex values, denom is 1 / (2 * signed area) in 28.4 units,
+// the gradients come out per subpixel and are scaled to pixels
+static F_INLINE FAttribPlane SetupAttribPlane(const SSTri& tri, float denom, float a0, float a1, float a2)
+{
+    const IPoint2D& p0 = tri.v0.position;
+    const IPoint2D& p1 = tri.v1.position;
+    const IPoint2D& p2 = tri.v2.position;
+
+    FAttribPlane ret;
+    ret.dadx = ((a0 - a2) * fround(p1.y - p2.y) + (a1 - a2) * fround(p2.y - p0.y)) * denom * 16.0F;
+    ret.dady = ((a0 - a2) * fround(p2.x - p1.x) + (a1 - a2) * fround(p0.x - p2.x)) * denom * 16.0F;
+    ret.a    = a2 - ret.dadx * (fround(p2.x) * (1.0F / 16.0F)) - ret.dady * (fround(p2.y) * (1.0F / 16.0F));
     return ret;
 }
 
-template <typename F>
-static F_INLINE void WritePixel(FRenderTarget*rt, size_t x, size_t y, F pixel)
+// lazy clears, a clear only marks the tiles of a target: rasterizing a tile fills it first, tiles nothing is drawn
+// into are filled at the end of the frame and skipped by the next clear to the same value
+enum ETileState
+{
+    TS_DIRTY   = 0, // drawn into since the last clear, or undefined
+    TS_PENDING = 1, // cleared to clearValue but not filled yet
+    TS_CLEAN   = 2  // holds clearValue
+};
+
+static F_INLINE int GetTilesX(const FRenderTarget* rt) { return (rt->width  + F_TILE_SIZE - 1) / F_TILE_SIZE; }
+static F_INLINE int GetTilesY(const FRenderTarget* rt) { return (rt->height + F_TILE_SIZE - 1) / F_TILE_SIZE; }
+
+// streaming stores bypass the cache for tiles nobody draws into this frame
+static F_INLINE void FillRow(uint32_t* dst, int count, uint32_t value, bool streaming)
 {
-    F* pixels = reinterpret_cast<F*>(rt->pixels);
-    pixels[y * rt->width + x] = pixel;
+#ifdef F_SIMD_SSE2
+    if (streaming) {
+        for (; count > 0 && (reinterpret_cast<uintptr_t>(dst) & 15); --count)
+            *dst++ = value;
+
+        __m128i v = _mm_set1_epi32(static_cast<int>(value));
+        for (; count >= 4; count -= 4, dst += 4)
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst), v);
+    }
+#endif
+    std::fill(dst, dst + count, value);
 }
 
-template <typename F>
-static F_INLINE F GetPixel(FRenderTarget* rt, size_t x, size_t y)
+static void FillTile(FRenderTarget* rt, int tile, bool streaming)
 {
-    F* pixels = reinterpret_cast<F*>(rt->pixels);
-    return pixels[y * rt->width + x];
+    int x0 = (tile % GetTilesX(rt)) * F_TILE_SIZE;
+    int y0 = (tile / GetTilesX(rt)) * F_TILE_SIZE;
+    int x1 = imin(x0 + F_TILE_SIZE, rt->width);
+    int y1 = imin(y0 + F_TILE_SIZE, rt->height);
+
+    // both formats are 32 bits per sample, multisampled colors are reset to one per pixel
+    int samples = rt->pixelFormat == PF_DEPTH ? static_cast<int>(rt->samples) : 1;
+
+    uint32_t* pixels = reinterpret_cast<uint32_t*>(rt->pixels);
+    for (int y = y0; y < y1; ++y)
+        FillRow(pixels + (size_t(y) * rt->width + x0) * samples, (x1 - x0) * samples, rt->clearValue, streaming);
+
+    if (rt->sampleFlags) {
+        for (int y = y0; y < y1; ++y)
+            std::memset(rt->sampleFlags + size_t(y) * rt->width + x0, 0, x1 - x0);
+    }
+
+#ifdef F_SIMD_SSE2
+    if (streaming)
+        _mm_sfence();
+#endif
+
+    if (rt->pixelFormat == PF_DEPTH) {
+        float depth;
+        std::memcpy(&depth, &rt->clearValue, sizeof(depth));
+
+        for (int y = y0; y < y1; y += 8) {
+            for (int x = x0; x < x1; x += 8)
+                GetBlockMaxDepth(rt, x, y) = depth;
+        }
+    }
 }
 
-// temporary texture
-#define F_ARGB(a, r, g, b) ((a << 24) | (r << 16) | (g << 8) | (b << 0))
-const TPixelARGB8 g_grey  = F_ARGB(255, 127, 127, 127);
-const TPixelARGB8 g_white = F_ARGB(255, 255, 255, 255);
+static void RequestClear(FRenderTarget* rt, uint32_t value)
+{
+    // tiles still holding the same value need no work
+    bool   sameValue = value == rt->clearValue;
+    size_t numTiles  = size_t(GetTilesX(rt)) * GetTilesY(rt);
 
-TPixelARGB8 g_texture[4 * 4] = {
-    g_grey,  g_grey,  g_white, g_white,
-    g_grey,  g_grey,  g_white, g_white,
-    g_white, g_white, g_grey,  g_grey,
-    g_white, g_white, g_grey,  g_grey
-};
+    for (size_t i = 0; i < numTiles; ++i) {
+        if (!sameValue || rt->tileState[i] == TS_DIRTY)
+            rt->tileState[i] = TS_PENDING;
+    }
+
+    rt->clearValue = value;
+}
 
-static F_INLINE void WriteTriPixel(FRenderTarget* colorRT, FRenderTarget* depthRT, int x, int y, const SSTri& tri)
+// before drawing into a tile, fills it while it's about to be in the cache anyway
+static F_INLINE void PrepareTile(FRenderTarget* rt, int tx, int ty)
 {
-    FPoint3D blerp = CalculateBarycentricCoords(tri, {x, y});
+    // the depth target may be larger than the color target, so each target has its own tile index
+    int tile = ty * GetTilesX(rt) + tx;
+    if (rt->tileState[tile] == TS_PENDING)
+        FillTile(rt, tile, false);
+    rt->tileState[tile] = TS_DIRTY;
+}
 
-    float    bdepth    = tri.v0.depth * blerp.x + tri.v1.depth * blerp.y + tri.v2.depth * blerp.z;
-    float    depth     = GetPixel<TPixelDepth>(depthRT, x, y);
-    FPoint3D btexcoord = tri.v0.texcoord * blerp.x + tri.v1.texcoord * blerp.y + tri.v2.texcoord * blerp.z;
-    int tx             = iround(btexcoord.x * 4.0F);
-    int ty             = iround(btexcoord.y * 4.0F);
-    //TPixelARGB8 color  = GetPixel<TPixelARGB8>(ctx.texture0, tx, ty);
-    TPixelARGB8 color  = g_texture[ty * 4 + tx];
+// at the end of the frame, for tiles nothing was drawn into
+static F_INLINE void ResolveTile(FRenderTarget* rt, int tx, int ty)
+{
+    int tile = ty * GetTilesX(rt) + tx;
+    if (rt->tileState[tile] == TS_PENDING) {
+        FillTile(rt, tile, true);
+        rt->tileState[tile] = TS_CLEAN;
+    }
+}
 
-    if (bdepth < depth) {
-        WritePixel<TPixelDepth>(depthRT, x, y, bdepth);
-        WritePixel<TPixelARGB8>(colorRT, x, y, color);
+static void MarkTilesDirty(FRenderTarget* rt, int x0, int y0, int x1, int y1) // pixels in [x0, x1) x [y0, y1)
+{
+    x0 = iclamp(x0, 0, rt->width);
+    y0 = iclamp(y0, 0, rt->height);
+    x1 = iclamp(x1, 0, rt->width);
+    y1 = iclamp(y1, 0, rt->height);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    for (int ty = y0 / F_TILE_SIZE; ty <= (y1 - 1) / F_TILE_SIZE; ++ty) {
+        for (int tx = x0 / F_TILE_SIZE; tx <= (x1 - 1) / F_TILE_SIZE; ++tx)
+            rt->tileState[ty * GetTilesX(rt) + tx] = TS_DIRTY;
     }
 }
 
-static void RasterizeTriangles(FRenderTarget* colorRT, FRenderTarget* depthRT, size_t numTris, SSTri* tris)
+// average of the four samples of a pixel, rounded
+static F_INLINE uint32_t ResolveSamples(const uint32_t* samples)
 {
-    F_NAMED_PROFILE(Rasterize_Triangles);
+#ifdef F_SIMD_SSE2
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i s   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples));
+    __m128i sum = _mm_add_epi16(_mm_unpacklo_epi8(s, zero), _mm_unpackhi_epi8(s, zero));
+    sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+    sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum)));
+#else
+    uint32_t ret = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t sum = 2;
+        for (int s = 0; s < F_MSAA_SAMPLES; ++s)
+            sum += (samples[s] >> shift) & 0xFF;
+        ret |= (sum >> 2) << shift;
+    }
+    return ret;
+#endif
+}
 
-    for (size_t i = 0; i < numTris; ++i) {
-        const SSTri& tri = tris[i];
-
-        // 28.4 fixed-point coordinates
-        const int Y1 = iround(16.0f * tri.v0.position.y);
-        const int Y2 = iround(16.0f * tri.v1.position.y);
-        const int Y3 = iround(16.0f * tri.v2.position.y);
-
-        const int X1 = iround(16.0f * tri.v0.position.x);
-        const int X2 = iround(16.0f * tri.v1.position.x);
-        const int X3 = iround(16.0f * tri.v2.position.x);
-
-        // Deltas
-        const int DX12 = X1 - X2;
-        const int DX23 = X2 - X3;
-        const int DX31 = X3 - X1;
-
-        const int DY12 = Y1 - Y2;
-        const int DY23 = Y2 - Y3;
-        const int DY31 = Y3 - Y1;
-
-        // Fixed-point deltas
-        const int FDX12 = DX12 << 4;
-        const int FDX23 = DX23 << 4;
-        const int FDX31 = DX31 << 4;
-
-        const int FDY12 = DY12 << 4;
-        const int FDY23 = DY23 << 4;
-        const int FDY31 = DY31 << 4;
-
-        // Bounding rectangle
-        int minx = (imin3(X1, X2, X3) + 0xF) >> 4;
-        int maxx = (imax3(X1, X2, X3) + 0xF) >> 4;
-        int miny = (imin3(Y1, Y2, Y3) + 0xF) >> 4;
-        int maxy = (imax3(Y1, Y2, Y3) + 0xF) >> 4;
-
-        // Block size, standard 8x8 (must be power of two)
-        const int q = 8;
-
-        // Start in corner of 8x8 block
-        minx &= ~(q - 1);
-        miny &= ~(q - 1);
-
-        // Clip
-        minx = imax(0, imin(minx, colorRT->width - 1));
-        maxx = imax(0, imin(maxx, colorRT->width - 1));
-
-        miny = imax(0, imin(miny, colorRT->height - 1));
-        maxy = imax(0, imin(maxy, colorRT->height - 1));
-
-        // Half-edge constants
-        int C1 = DY12 * X1 - DX12 * Y1;
-        int C2 = DY23 * X2 - DX23 * Y2;
-        int C3 = DY31 * X3 - DX31 * Y3;
-
-        // Correct for fill convention
-        if (DY12 < 0 || (DY12 == 0 && DX12 > 0)) C1++;
-        if (DY23 < 0 || (DY23 == 0 && DX23 > 0)) C2++;
-        if (DY31 < 0 || (DY31 == 0 && DX31 > 0)) C3++;
-
-        // Loop through blocks
-        for (int y = miny; y < maxy; y += q) {
-            for (int x = minx; x < maxx; x += q) {
-                // Corners of block
-                int x0 = x << 4;
-                int x1 = (x + q - 1) << 4;
-                int y0 = y << 4;
-                int y1 = (y + q - 1) << 4;
-
-                // Evaluate half-space functions
-                bool a00 = C1 + DX12 * y0 - DY12 * x0 > 0;
-                bool a10 = C1 + DX12 * y0 - DY12 * x1 > 0;
-                bool a01 = C1 + DX12 * y1 - DY12 * x0 > 0;
-                bool a11 = C1 + DX12 * y1 - DY12 * x1 > 0;
-                int a = (a00 << 0) | (a10 << 1) | (a01 << 2) | (a11 << 3);
-
-                bool b00 = C2 + DX23 * y0 - DY23 * x0 > 0;
-                bool b10 = C2 + DX23 * y0 - DY23 * x1 > 0;
-                bool b01 = C2 + DX23 * y1 - DY23 * x0 > 0;
-                bool b11 = C2 + DX23 * y1 - DY23 * x1 > 0;
-                int b = (b00 << 0) | (b10 << 1) | (b01 << 2) | (b11 << 3);
-
-                bool c00 = C3 + DX31 * y0 - DY31 * x0 > 0;
-                bool c10 = C3 + DX31 * y0 - DY31 * x1 > 0;
-                bool c01 = C3 + DX31 * y1 - DY31 * x0 > 0;
-                bool c11 = C3 + DX31 * y1 - DY31 * x1 > 0;
-                int c = (c00 << 0) | (c10 << 1) | (c01 << 2) | (c11 << 3);
-
-                // Skip block when outside an edge
-                if (a == 0x0 || b == 0x0 || c == 0x0) continue;
-
-                // Accept whole block when totally covered
-                if (a == 0xF && b == 0xF && c == 0xF) {
-                    for (int iy = y; iy < y + q; ++iy) {
-                        for (int ix = x; ix < x + q; ++ix) {
-                            #ifdef F_RASTERIZER_VIZ_COVERAGE
-                            WritePixel<TPixelARGB8>(colorRT, ix, iy, FULL_COVERED_COLOR);
-                            #else
-                            WriteTriPixel(colorRT, depthRT, ix, iy, tri);
-                            #endif
-                        }
-                    }
-                } else { // Partially covered block
-                    int CY1 = C1 + DX12 * y0 - DY12 * x0;
-                    int CY2 = C2 + DX23 * y0 - DY23 * x0;
-                    int CY3 = C3 + DX31 * y0 - DY31 * x0;
-
-                    for (int iy = y; iy < y + q; iy++) {
-                        int CX1 = CY1;
-                        int CX2 = CY2;
-                        int CX3 = CY3;
-
-                        for (int ix = x; ix < x + q; ix++) {
-                            if (CX1 > 0 && CX2 > 0 && CX3 > 0) {
-                                #ifdef F_RASTERIZER_VIZ_COVERAGE
-                                WritePixel<TPixelARGB8>(colorRT, ix, iy, PARTIALLY_COVERED_COLOR);
-                                #else
-                                WriteTriPixel(colorRT, depthRT, ix, iy, tri);
-                                #endif
-                            }
-
-                            CX1 -= FDY12;
-                            CX2 -= FDY23;
-                            CX3 -= FDY31;
-                        }
-
-                        CY1 += FDX12;
-                        CY2 += FDX23;
-                        CY3 += FDX31;
-                    }
-                }
-            }
+static void ResolveRow(const FRenderTarget* src, size_t offset, int count, uint32_t* dst)
+{
+    const uint32_t* pixels  = reinterpret_cast<const uint32_t*>(src->pixels) + offset;
+    const uint8_t*  flags   = src->sampleFlags + offset;
+    const uint32_t* samples = src->samplePixels + offset * F_MSAA_SAMPLES;
+
+    int x = 0;
+#ifdef F_SIMD_SSE2
+    // most runs of 16 pixels are crossed by no edge and only copied
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; x + 16 <= count; x += 16) {
+        __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(flags + x));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(f, zero)) == 0xFFFF) {
+            for (int i = 0; i < 16; i += 4)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x + i)));
+            continue;
         }
+
+        for (int i = x; i < x + 16; ++i)
+            dst[i] = flags[i] ? ResolveSamples(samples + size_t(i) * F_MSAA_SAMPLES) : pixels[i];
     }
+#endif
+    for (; x < count; ++x)
+        dst[x] = flags[x] ? ResolveSamples(samples + size_t(x) * F_MSAA_SAMPLES) : pixels[x];
 }
 
+// right after the tile was rasterized, while it's still in the cache. dst has the size of src,
+// rows of the last tiles end at the edge of the targets
+static void ResolveMultisampleTile(const FRenderTarget* src, FRenderTarget* dst, int tile)
+{
+    int x0 = (tile % GetTilesX(src)) * F_TILE_SIZE;
+    int y0 = (tile / GetTilesX(src)) * F_TILE_SIZE;
+    int x1 = imin(x0 + F_TILE_SIZE, src->width);
+    int y1 = imin(y0 + F_TILE_SIZE, src->height);
+
+    uint32_t* pixels = reinterpret_cast<uint32_t*>(dst->pixels);
+
+    // tiles holding the clear color have no flagged pixel
+    bool clean = src->tileState[tile] == TS_CLEAN;
+
+    for (int y = y0; y < y1; ++y) {
+        size_t offset = size_t(y) * src->width + x0;
+        if (clean)
+            FillRow(pixels + offset, x1 - x0, src->clearValue, true);
+        else
+            ResolveRow(src, offset, x1 - x0, pixels + offset);
+    }
+
+#ifdef F_SIMD_SSE2
+    if (clean)
+        _mm_sfence();
+#endif
+
+    dst->tileState[tile] = TS_DIRTY;
+}
+
+// setup records only hold the varyings of their triangle
+static F_INLINE size_t GetTriSetupSize(uint32_t numVaryings)
+{
+    size_t size = offsetof(FTriSetup, varyings) + numVaryings * sizeof(FAttribPlane);
+    return (size + alignof(FTriSetup) - 1) & ~(alignof(FTriSetup) - 1);
+}
+
+// returns false when the triangle can't produce any pixel
+static bool SetupTriangle(const SSTri& tri, int width, int height, uint32_t samples, FTriSetup& out)
+{
+    // per-triangle attribute setup, replaces barycentric coordinates per pixel
+    int64_t d = int64_t(tri.v1.position.y - tri.v2.position.y) * (tri.v0.position.x - tri.v2.position.x) + int64_t(tri.v2.position.x - tri.v1.position.x) * (tri.v0.position.y - tri.v2.position.y);
+    if (d == 0)
+        return false;
+
+    float denom = 1.0F / static_cast<float>(d);
+
+    const FPipeline* pipeline    = tri.pipeline;
+    const uint32_t   numVaryings = tri.numVaryings;
+    const float*     varyings    = tri.varyings;
+
+    out.depth = SetupAttribPlane(tri, denom, tri.v0.depth, tri.v1.depth, tri.v2.depth);
+    for (uint32_t v = 0; v < numVaryings; ++v)
+        out.varyings[v] = SetupAttribPlane(tri, denom, varyings[v], varyings[numVaryings + v], varyings[2 * numVaryings + v]);
+
+    // 28.4 fixed-point coordinates, snapped at projection
+    const int Y1 = tri.v0.position.y;
+    const int Y2 = tri.v1.position.y;
+    const int Y3 = tri.v2.position.y;
+
+    const int X1 = tri.v0.position.x;
+    const int X2 = tri.v1.position.x;
+    const int X3 = tri.v2.position.x;
+
+    // Deltas
+    const int DX12 = X1 - X2;
+    const int DX23 = X2 - X3;
+    const int DX31 = X3 - X1;
+
+    const int DY12 = Y1 - Y2;
+    const int DY23 = Y2 - Y3;
+    const int DY31 = Y3 - Y1;
+
+    // Bounding rectangle, samples reach past the pixel centers
+    const int margin = samples > 1 ? F_SAMPLE_EXTENT : 0;
+
+    int minx = (imin3(X1, X2, X3) - margin + 0xF) >> 4;
+    int maxx = (imax3(X1, X2, X3) + margin + 0xF) >> 4;
+    int miny = (imin3(Y1, Y2, Y3) - margin + 0xF) >> 4;
+    int maxy = (imax3(Y1, Y2, Y3) + margin + 0xF) >> 4;
+
+    // Start in corner of 8x8 block
+    minx &= ~7;
+    miny &= ~7;
+
+    // Clip, the max corner is exclusive
+    out.minx = imax(0, imin(minx, width));
+    out.maxx = imax(0, imin(maxx, width));
+
+    out.miny = imax(0, imin(miny, height));
+    out.maxy = imax(0, imin(maxy, height));
+    if (out.minx >= out.maxx || out.miny >= out.maxy)
+        return false;
+
+    // Half-edge constants, 64-bit because guard band coordinates overflow 32-bit products
+    int64_t C1 = int64_t(DY12) * X1 - int64_t(DX12) * Y1;
+    int64_t C2 = int64_t(DY23) * X2 - int64_t(DX23) * Y2;
+    int64_t C3 = int64_t(DY31) * X3 - int64_t(DX31) * Y3;
+
+    // Correct for fill convention
+    if (DY12 < 0 || (DY12 == 0 && DX12 > 0)) C1++;
+    if (DY23 < 0 || (DY23 == 0 && DX23 > 0)) C2++;
+    if (DY31 < 0 || (DY31 == 0 && DX31 > 0)) C3++;
+
+    out.C[0]  = C1;
+    out.C[1]  = C2;
+    out.C[2]  = C3;
+    out.DX[0] = DX12;
+    out.DX[1] = DX23;
+    out.DX[2] = DX31;
+    out.DY[0] = DY12;
+    out.DY[1] = DY23;
+    out.DY[2] = DY31;
+
+    out.minDepth = tri.v0.depth < tri.v1.depth ? tri.v0.depth : tri.v1.depth;
+    out.minDepth = tri.v2.depth < out.minDepth ? tri.v2.depth : out.minDepth;
+
+    // Mip level, constant across the triangle because varyings are interpolated affinely
+    out.lod = 0.0F;
+    if (tri.texture && pipeline->textured && tri.colorWrite)
+        out.lod = ComputeTextureLod(tri.texture, out.varyings[0].dadx, out.varyings[1].dadx, out.varyings[0].dady, out.varyings[1].dady);
+
+    out.texture   = tri.texture;
+    out.sampler   = tri.sampler;
+    out.constants = tri.constants;
+    out.blend     = tri.blend;
+
+    EColorOutput color = !tri.colorWrite ? CO_NONE : tri.blend.enable ? CO_BLEND : CO_WRITE;
+    out.rasterize = pipeline->rasterize[tri.depthState.func][tri.depthState.write][color][samples > 1];
+    return true;
+}
+
+static void RasterizeTriangles(FTileContext& tile, size_t numTris, const FTriSetup* const* tris)
+{
+    for (size_t i = 0; i < numTris; ++i)
+        tris[i]->rasterize(tile, *tris[i]);
+}
+
+// clipping
+struct FClipVertex // clip-space vertex with the attributes interpolated by the clipper
+{
+    FPoint4D position;
+    float    varyings[F_MAX_VARYINGS];
+};
+
+// polygon clipped against the near, far and four guard band planes
+#define F_MAX_CLIP_VERTICES (3 + 6)
+
+// transformed vertices of the current draw in structure-of-arrays layout, indexed like the vertex buffer
+struct FVertexCache
+{
+    std::vector<float>    clipX;
+    std::vector<float>    clipY;
+    std::vector<float>    clipZ;
+    std::vector<float>    clipW;
+    std::vector<int>      screenX;
+    std::vector<int>      screenY;
+    std::vector<float>    depth;
+    std::vector<uint32_t> outcode;
+    std::vector<float>    varyings; // written by the vertex shader of the draw, as many per vertex as it has
+
+    // sparse indexed draws transform vertices on first use, a slot is valid when its tag matches the draw
+    std::vector<uint32_t> tags;
+    uint32_t              drawTag = 0;
+
+    void Reserve(size_t numVertices)
+    {
+        if (tags.size() >= numVertices)
+            return;
+
+        clipX.resize(numVertices);
+        clipY.resize(numVertices);
+        clipZ.resize(numVertices);
+        clipW.resize(numVertices);
+        screenX.resize(numVertices);
+        screenY.resize(numVertices);
+        depth.resize(numVertices);
+        outcode.resize(numVertices);
+        varyings.resize(numVertices * F_MAX_VARYINGS);
+        tags.resize(numVertices, drawTag);
+    }
+
+    void BeginSparseDraw()
+    {
+        // on wrap-around stale tags could match again
+        if (++drawTag == 0) {
+            std::fill(tags.begin(), tags.end(), 0);
+            drawTag = 1;
+        }
+    }
+
+    FTransformedVertices At(size_t first)
+    {
+        return { &clipX[first], &clipY[first], &clipZ[first], &clipW[first], &screenX[first], &screenY[first], &depth[first], &outcode[first] };
+    }
+};
+
 // draw context
+// adds the wall time of a scope to a stage time in FPipelineStatistics
+struct FStageTimer
+{
+    std::chrono::steady_clock::time_point tmStart;
+    float&                                 time;
+
+    F_INLINE explicit FStageTimer(float& stageTime)
+        : tmStart(std::chrono::steady_clock::now()), time(stageTime)
+    {
+    }
+
+    F_INLINE ~FStageTimer()
+    {
+        time += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - tmStart).count();
+    }
+};
+
+struct FThreadStatistics
+{
+    FPipelineStatistics stats;
+    uint8_t             padding[64]; // workers don't share cache lines
+};
+
+struct FThreadArena
+{
+    FArena  arena;
+    uint8_t padding[64]; // workers don't share cache lines
+};
+
+#define F_TRIANGLE_BLOCK_SIZE 256
+#define F_BIN_BLOCK_SIZE      62
+
+// triangles are stored in fixed-size blocks, so that they never move once emitted
+struct FTriangleBlock
+{
+    SSTri tris[F_TRIANGLE_BLOCK_SIZE];
+};
+
+// piece of a tile's triangle list, 512 bytes on 64-bit targets
+struct FBinBlock
+{
+    FBinBlock*       next;
+    uint32_t         count;
+    const FTriSetup* tris[F_BIN_BLOCK_SIZE];
+};
+
+struct FBinList
+{
+    FBinBlock* head;
+    FBinBlock* tail;
+};
+
+// everything the raster stage of a frame works on, the vertex stage fills one frame while the other rasterizes
+struct FFrame
+{
+    // triangles in submission order, allocated by the vertex stage and released all at once when the frame is reused
+    FArena                       triangleArena;
+    std::vector<FTriangleBlock*> triangleBlocks;
+    size_t                       numTriangles = 0;
+
+    // targets bound at fglPresentAsync
+    FRenderTarget*     colorRT = nullptr;
+    FRenderTarget*     depthRT = nullptr;
+    FRenderTarget*     resolveRT = nullptr;
+
+    // fglClear is deferred to the raster stage
+    bool               clear = false;
+    uint32_t           clearColor = 0;
+    float              clearDepth = 1.0F;
+
+    FPipelineStatistics stats = {};
+    TFrameHandle        handle = 0;
+};
+
 struct DrawContext
 {
-    std::vector<SSTri> screenTris;
+    FFrame             frames[2];
+    uint32_t           recordingFrame = 0; // the one filled by the vertex stage
+    TFrameHandle       lastFrame = 0;
+
+    FThreadPool        threadPool;
+
+    // written by the raster stage
+    std::vector<FThreadStatistics> threadStats;
+
+    // Per-tile triangle lists of the rasterizing frame. Every thread bins a contiguous range of triangles
+    // into lists of its own allocated from its own arena, range r keeps the list of tile t at binLists[r * numTiles + t].
+    int                            tilesX = 0;
+    int                            tilesY = 0;
+    size_t                         numBinRanges = 0;
+    std::vector<FBinList>          binLists;
+    std::vector<FThreadArena>      binArenas;
+
+    // frame completion, guarded by frameMutex
+    std::mutex                     frameMutex;
+    std::condition_variable        frameCondition;
+    TFrameHandle                   completedFrame = 0;
+    FPipelineStatistics            lastFrameStats = {};
+    uint64_t                       triangleMemoryHighWater = 0;
+    uint64_t                       binMemoryHighWater = 0;
+
+    // runs the raster stage, declared after everything it uses so that it's destroyed first
+    FTaskThread        rasterThread;
 
     FRenderTarget*     colorRT = nullptr;
     FRenderTarget*     depthRT = nullptr;
+    FRenderTarget*     resolveRT = nullptr;
 
-    FVertexBuffer*     vertexBuffer = nullptr;
-    FIndexBuffer*      indexBuffer  = nullptr;
+    const FVertexFormat* vertexFormat = nullptr;
+    FVertexBuffer*       vertexStreams[F_MAX_VERTEX_STREAMS] = {};
+    FIndexBuffer*        indexBuffer  = nullptr;
+    FVertexFetch         vertexFetch; // resolved for the current draw
+    const float*         positions;   // of vertex 0
+    size_t               positionStride; // in floats
 
     TDrawMatrix        matrices[DM_COUNT];
     TDrawMatrix        MVP;
+    FViewport          viewport;
+    ECullMode          cullMode = CM_CW;
+    const FTexture*    texture  = nullptr;
+    FSamplerState      sampler  = { TF_NEAREST, TA_WRAP, TA_WRAP };
+    FDepthState        depthState = { DF_LESS, true };
+    bool               colorWrite = true;
+    FBlendState        blendState = { false, BF_ONE, BF_ZERO, BO_ADD };
+
+    const FPipeline*     pipeline = nullptr;
+    const FPipeline*     drawPipeline = nullptr; // the one the current draw runs, resolved from pipeline and texture
+    std::vector<uint8_t> constants;
+    const void*          frameConstants = nullptr; // copy of constants in the recording frame, made on first use
+
+    FVertexCache       vertexCache;
+
+    // tiles follow the color target, the depth target has to cover it
+    F_INLINE bool IsValid() const
+    {
+        return colorRT != nullptr && depthRT != nullptr && colorRT->samples == depthRT->samples &&
+               depthRT->width >= colorRT->width && depthRT->height >= colorRT->height;
+    }
 
-    F_INLINE bool IsValid() const { return colorRT != nullptr && depthRT != nullptr; }
+    F_INLINE FFrame& RecordingFrame() { return frames[recordingFrame]; }
 } g_drawContext;
 
 // render targets
 FRenderTarget* FRenderTarget::Allocate(uint32_t width, uint32_t height, EPixelFormat format)
 {
+    return Allocate(width, height, format, 1);
+}
+
+FRenderTarget* FRenderTarget::Allocate(uint32_t width, uint32_t height, EPixelFormat format, uint32_t samples)
+{
+    if (samples != 1 && samples != F_MSAA_SAMPLES)
+        return nullptr;
+
+    size_t numPixels = size_t(width) * height;
+
     FRenderTarget* rt = new FRenderTarget;
     rt->width = width;
     rt->height = height;
     rt->pixelFormat = format;
-    rt->pixels = new unsigned char[width * height * g_MapPixelFormatSize[format]];
+    rt->samples = samples;
+    rt->pixels = new unsigned char[numPixels * g_MapPixelFormatSize[format] * (format == PF_DEPTH ? samples : 1)];
+    rt->blockMaxDepth = nullptr;
+    rt->sampleFlags = nullptr;
+    rt->samplePixels = nullptr;
+
+    if (format == PF_ARGB8 && samples > 1) {
+        rt->sampleFlags  = new uint8_t[numPixels];
+        rt->samplePixels = new uint32_t[numPixels * samples];
+        std::fill(rt->sampleFlags, rt->sampleFlags + numPixels, uint8_t(0));
+    }
+
+    // contents are undefined, the first clear has to write every tile
+    size_t numTiles = size_t(GetTilesX(rt)) * GetTilesY(rt);
+    rt->tileState  = new uint8_t[numTiles];
+    rt->clearValue = 0;
+    std::fill(rt->tileState, rt->tileState + numTiles, uint8_t(TS_DIRTY));
+
+    if (format == PF_DEPTH) {
+        // contents are undefined until the first clear, so nothing can be culled
+        size_t numBlocks = GetDepthBlocksX(rt) * GetDepthBlocksY(rt);
+        rt->blockMaxDepth = new float[numBlocks];
+        std::fill(rt->blockMaxDepth, rt->blockMaxDepth + numBlocks, FLT_MAX);
+    }
     return rt;
 }
 
 void FRenderTarget::Release(FRenderTarget* rt)
 {
+    delete [] rt->pixels;
+    delete [] rt->blockMaxDepth;
+    delete [] rt->sampleFlags;
+    delete [] rt->samplePixels;
+    delete [] rt->tileState;
     delete rt;
 }
 
 // vertex processing
 FVertexBuffer* FVertexBuffer::Allocate(FVertexBuffer::FixedVertex* data, size_t size)
 {
+    return Allocate(data, size, sizeof(FixedVertex));
+}
+
+FVertexBuffer* FVertexBuffer::Allocate(void* data, size_t size, uint32_t stride)
+{
+    if (stride % sizeof(float) != 0)
+        return nullptr;
+
     FVertexBuffer* ret = new FVertexBuffer;
-    ret->data = data;
+    ret->data = static_cast<uint8_t*>(data);
     ret->size = size;
+    ret->stride = stride;
     return ret;
 }
 
@@ -427,6 +821,45 @@ void FVertexBuffer::Release(FVertexBuffer* vbuf)
     delete vbuf;
 }
 
+FVertexFormat* FVertexFormat::Allocate(const FVertexElement* elements, size_t count)
+{
+    FVertexFormat* format = new FVertexFormat;
+    std::memset(format, 0, sizeof(FVertexFormat));
+
+    for (size_t i = 0; i < count; ++i) {
+        const FVertexElement& e = elements[i];
+
+        bool valid = e.semantic < VS_COUNT && e.stream < F_MAX_VERTEX_STREAMS && e.offset % sizeof(float) == 0 &&
+                     e.components >= 1 && e.components <= 4 && format->elements[e.semantic].components == 0;
+        if (!valid) {
+            delete format;
+            return nullptr;
+        }
+
+        format->elements[e.semantic] = e;
+        format->streamMask |= 1u << e.stream;
+    }
+
+    if (format->elements[VS_POSITION].components != 3) {
+        delete format;
+        return nullptr;
+    }
+    return format;
+}
+
+void FVertexFormat::Release(FVertexFormat* format)
+{
+    delete format;
+}
+
+static const FVertexElement g_fixedVertexElements[] = {
+    { VS_POSITION,  0, offsetof(FVertexBuffer::FixedVertex, vs_position), 3 },
+    { VS_TEXCOORD0, 0, offsetof(FVertexBuffer::FixedVertex, vs_texcoord), 2 },
+    { VS_NORMAL,    0, offsetof(FVertexBuffer::FixedVertex, vs_normal),   3 },
+};
+
+static const FVertexFormat* g_fixedVertexFormat = FVertexFormat::Allocate(g_fixedVertexElements, 3);
+
 FIndexBuffer* FIndexBuffer::Allocate(FIndexBuffer::FixedIndex* data, size_t size)
 {
     FIndexBuffer* ret = new FIndexBuffer;
@@ -441,132 +874,869 @@ void FIndexBuffer::Release(FIndexBuffer* ibuf)
     delete ibuf;
 }
 
-struct WSTri // world-space triangle
+// signed distance to the clip plane, >= 0 is inside
+static F_INLINE float ClipPlaneDistance(const FViewport& vp, uint32_t plane, const FPoint4D& p)
 {
-    FVertexBuffer::FixedVertex v0;
-    FVertexBuffer::FixedVertex v1;
-    FVertexBuffer::FixedVertex v2;
-};
+    switch (plane) {
+    case CP_NEAR:      return p.z + p.w;
+    case CP_FAR:       return p.w - p.z;
+    case CP_GB_LEFT:   return p.x - vp.gbMinX * p.w;
+    case CP_GB_RIGHT:  return vp.gbMaxX * p.w - p.x;
+    case CP_GB_BOTTOM: return p.y - vp.gbMinY * p.w;
+    case CP_GB_TOP:    return vp.gbMaxY * p.w - p.y;
+    default:           return 0.0F;
+    }
+}
 
-static F_INLINE bool ClipTriangle(const SSTri& tri) // not a real clipping
+static F_INLINE FClipVertex LerpClipVertex(const FClipVertex& a, const FClipVertex& b, float t, uint32_t numVaryings)
 {
-    return
-        (tri.v0.position.x >= 0 && tri.v0.position.x < g_drawContext.colorRT->width && tri.v0.position.y >= 0 && tri.v0.position.y < g_drawContext.colorRT->height) ||
-        (tri.v1.position.x >= 0 && tri.v1.position.x < g_drawContext.colorRT->width && tri.v1.position.y >= 0 && tri.v1.position.y < g_drawContext.colorRT->height) ||
-        (tri.v2.position.x >= 0 && tri.v2.position.x < g_drawContext.colorRT->width && tri.v2.position.y >= 0 && tri.v2.position.y < g_drawContext.colorRT->height);
+    FClipVertex ret;
+    ret.position = a.position + (b.position - a.position) * t;
+    for (uint32_t v = 0; v < numVaryings; ++v)
+        ret.varyings[v] = a.varyings[v] + (b.varyings[v] - a.varyings[v]) * t;
+    return ret;
 }
 
-static F_INLINE void ProjectTriangle(const WSTri& tri)
+// Sutherland-Hodgman against a single plane, returns the new vertex count
+static int ClipPolygon(const FViewport& vp, uint32_t plane, const FClipVertex* in, int count, FClipVertex* out, uint32_t numVaryings)
 {
-    FPoint4D v0{ tri.v0.vs_position[0], tri.v0.vs_position[1], tri.v0.vs_position[2], 1.0F };
-    FPoint4D v1{ tri.v1.vs_position[0], tri.v1.vs_position[1], tri.v1.vs_position[2], 1.0F };
-    FPoint4D v2{ tri.v2.vs_position[0], tri.v2.vs_position[1], tri.v2.vs_position[2], 1.0F };
+    int outCount = 0;
 
-    v0 = Mul(g_drawContext.MVP, v0);
-    v1 = Mul(g_drawContext.MVP, v1);
-    v2 = Mul(g_drawContext.MVP, v2);
+    for (int i = 0; i < count; ++i) {
+        const FClipVertex& a = in[i];
+        const FClipVertex& b = in[(i + 1) % count];
 
+        float da = ClipPlaneDistance(vp, plane, a.position);
+        float db = ClipPlaneDistance(vp, plane, b.position);
+
+        if (da >= 0.0F)
+            out[outCount++] = a;
+
+        if ((da >= 0.0F) != (db >= 0.0F))
+            out[outCount++] = LerpClipVertex(a, b, da / (da - db), numVaryings);
+    }
+
+    return outCount;
+}
+
+static F_INLINE SSPoint2D ToScreenSpace(const FViewport& vp, const FClipVertex& cv)
+{
     const FPoint4D half{ 0.5F, 0.5F, 0.0F, 0.0F };
-    const FPoint4D vp  { fround(g_drawContext.colorRT->width), fround(g_drawContext.colorRT->height), 1.0F, 1.0F };
+    const FPoint4D scale{ vp.width, vp.height, 1.0F, 1.0F };
+
+    FPoint4D v = ((cv.position / cv.position.w) * 0.5F + half) * scale;
+    return { { SnapToSubpixel(v.x), SnapToSubpixel(v.y) }, v.z };
+}
+
+// returns false when the triangle can't produce any pixels, flips it to the winding the rasterizer fills otherwise
+static F_INLINE bool CullTriangle(SSTri& tri, const float** varyings, ECullMode cullMode, uint32_t samples, FPipelineStatistics& stats)
+{
+    const IPoint2D& p0 = tri.v0.position;
+    const IPoint2D& p1 = tri.v1.position;
+    const IPoint2D& p2 = tri.v2.position;
+
+    // twice the signed area, the triangles arrive here in reverse submission order
+    // so positive means clockwise as submitted
+    int64_t area = int64_t(p1.x - p0.x) * (p2.y - p0.y) - int64_t(p2.x - p0.x) * (p1.y - p0.y);
+    if (area == 0) {
+        stats.culledDegenerate++;
+        return false;
+    }
+
+    bool clockwise = area > 0;
+    if ((cullMode == CM_CW && clockwise) || (cullMode == CM_CCW && !clockwise)) {
+        stats.culledBackFace++;
+        return false;
+    }
+
+    // no pixel center inside the bounding box, or no sample of a multisampled target
+    const int margin = samples > 1 ? F_SAMPLE_EXTENT : 0;
+
+    int minx = (imin3(p0.x, p1.x, p2.x) - margin + 0xF) >> 4;
+    int maxx = (imax3(p0.x, p1.x, p2.x) + margin) >> 4;
+    int miny = (imin3(p0.y, p1.y, p2.y) - margin + 0xF) >> 4;
+    int maxy = (imax3(p0.y, p1.y, p2.y) + margin) >> 4;
+    if (minx > maxx || miny > maxy) {
+        stats.culledDegenerate++;
+        return false;
+    }
+
+    // the rasterizer only fills counter-clockwise (as submitted) triangles
+    if (clockwise) {
+        std::swap(tri.v1, tri.v2);
+        std::swap(varyings[1], varyings[2]);
+    }
+
+    return true;
+}
+
+// varyings are only needed when the draw writes color
+static F_INLINE uint32_t GetDrawVaryings()
+{
+    return g_drawContext.colorWrite ? g_drawContext.drawPipeline->numVaryings : 0;
+}
+
+// varyings holds the ones of every vertex
+static F_INLINE void EmitTriangle(const SSPoint2D& v0, const SSPoint2D& v1, const SSPoint2D& v2, const float** varyings)
+{
+    FFrame& frame = g_drawContext.RecordingFrame();
 
-    v0 = ((v0 / v0.w) * 0.5F + half) * vp;
-    v1 = ((v1 / v1.w) * 0.5F + half) * vp;
-    v2 = ((v2 / v2.w) * 0.5F + half) * vp;
+    SSTri tri = {};
+    tri.v0 = v0;
+    tri.v1 = v1;
+    tri.v2 = v2;
 
-    FPoint3D v0_tex{ tri.v0.vs_texcoord[0], tri.v0.vs_texcoord[1], v0.z };
-    FPoint3D v1_tex{ tri.v1.vs_texcoord[0], tri.v1.vs_texcoord[1], v1.z };
-    FPoint3D v2_tex{ tri.v2.vs_texcoord[0], tri.v2.vs_texcoord[1], v2.z };
+    if (CullTriangle(tri, varyings, g_drawContext.cullMode, g_drawContext.colorRT->samples, frame.stats)) {
+        uint32_t numVaryings = GetDrawVaryings();
 
-    SSPoint2D p0 = { iround(v0.x), iround(v0.y), v0.z, v0_tex };
-    SSPoint2D p1 = { iround(v1.x), iround(v1.y), v1.z, v1_tex };
-    SSPoint2D p2 = { iround(v2.x), iround(v2.y), v2.z, v2_tex };
+        float* packed = nullptr;
+        if (numVaryings) {
+            packed = frame.triangleArena.Allocate<float>(3 * numVaryings);
+            for (int v = 0; v < 3; ++v)
+                std::memcpy(packed + v * numVaryings, varyings[v], numVaryings * sizeof(float));
+        }
+
+        tri.varyings    = packed;
+        tri.numVaryings = numVaryings;
+        tri.pipeline    = g_drawContext.drawPipeline;
+        tri.constants   = g_drawContext.frameConstants;
+        tri.texture     = g_drawContext.texture;
+        tri.sampler     = g_drawContext.sampler;
+        tri.depthState  = g_drawContext.depthState;
+        tri.colorWrite  = g_drawContext.colorWrite;
+        tri.blend       = g_drawContext.blendState;
+        size_t slot = frame.numTriangles % F_TRIANGLE_BLOCK_SIZE;
+        if (slot == 0)
+            frame.triangleBlocks.push_back(frame.triangleArena.Allocate<FTriangleBlock>());
+
+        frame.triangleBlocks.back()->tris[slot] = tri;
+        frame.numTriangles++;
+    }
+}
+
+static const TTransformVerticesFn g_transformVertices = F_SelectTransformVertices();
+
+static F_INLINE void ShadeVertices(size_t first, size_t count)
+{
+    uint32_t numVaryings = GetDrawVaryings();
+    if (numVaryings == 0)
+        return;
+
+    FVertexCache& cache = g_drawContext.vertexCache;
+    g_drawContext.drawPipeline->shadeVertices(g_drawContext.vertexFetch, first, count, g_drawContext.frameConstants, &cache.varyings[first * numVaryings]);
+}
+
+static F_INLINE void TransformVertices(size_t first, size_t count)
+{
+    FVertexCache& cache = g_drawContext.vertexCache;
+    size_t stride = g_drawContext.positionStride;
+
+    g_transformVertices(g_drawContext.MVP, g_drawContext.viewport, g_drawContext.positions + first * stride, stride, count, cache.At(first));
+    ShadeVertices(first, count);
+
+    g_drawContext.RecordingFrame().stats.verticesTransformed += count;
+}
+
+// sparse indexed draws, every referenced vertex is still transformed once per draw
+static F_INLINE void FetchVertex(FIndexBuffer::FixedIndex index)
+{
+    FVertexCache& cache = g_drawContext.vertexCache;
+    size_t stride = g_drawContext.positionStride;
+
+    if (cache.tags[index] != cache.drawTag) {
+        cache.tags[index] = cache.drawTag;
+        TransformVertices_Scalar(g_drawContext.MVP, g_drawContext.viewport, g_drawContext.positions + index * stride, stride, 1, cache.At(index));
+        ShadeVertices(index, 1);
 
-    SSTri stri{p0, p1, p2};
-    if (ClipTriangle(stri)) {
-        g_drawContext.screenTris.push_back(stri);
+        g_drawContext.RecordingFrame().stats.verticesTransformed++;
+    }
+}
+
+static F_INLINE SSPoint2D GetScreenVertex(size_t i)
+{
+    const FVertexCache& cache = g_drawContext.vertexCache;
+    return { { cache.screenX[i], cache.screenY[i] }, cache.depth[i] };
+}
+
+static F_INLINE const float* GetVertexVaryings(size_t i, uint32_t numVaryings)
+{
+    return g_drawContext.vertexCache.varyings.data() + i * numVaryings;
+}
+
+static F_INLINE FClipVertex GetClipVertex(size_t i, uint32_t numVaryings)
+{
+    const FVertexCache& cache = g_drawContext.vertexCache;
+    const float* varyings = GetVertexVaryings(i, numVaryings);
+
+    FClipVertex ret;
+    ret.position = { cache.clipX[i], cache.clipY[i], cache.clipZ[i], cache.clipW[i] };
+    for (uint32_t v = 0; v < numVaryings; ++v)
+        ret.varyings[v] = varyings[v];
+    return ret;
+}
+
+// vertices must be transformed already
+static F_INLINE void ProjectTriangle(size_t i0, size_t i1, size_t i2)
+{
+    const FViewport& vp = g_drawContext.viewport;
+    const std::vector<uint32_t>& outcode = g_drawContext.vertexCache.outcode;
+
+    FPipelineStatistics& stats = g_drawContext.RecordingFrame().stats;
+    const uint32_t numVaryings = GetDrawVaryings();
+
+    // trivial reject, all vertices outside the same view volume plane
+    if (outcode[i0] & outcode[i1] & outcode[i2] & CP_VIEW_VOLUME) {
+        stats.culledFrustum++;
+        return;
+    }
+
+    // trivial accept, inside the guard band and between near and far
+    uint32_t ocUnion = outcode[i0] | outcode[i1] | outcode[i2];
+    if ((ocUnion & CP_MUST_CLIP) == 0) {
+        const float* varyings[3] = { GetVertexVaryings(i0, numVaryings), GetVertexVaryings(i1, numVaryings), GetVertexVaryings(i2, numVaryings) };
+        EmitTriangle(GetScreenVertex(i0), GetScreenVertex(i1), GetScreenVertex(i2), varyings);
+        return;
+    }
+
+    stats.clippedTriangles++;
+
+    FClipVertex poly[2][F_MAX_CLIP_VERTICES];
+    int count = 3;
+    int src = 0;
+
+    poly[0][0] = GetClipVertex(i0, numVaryings);
+    poly[0][1] = GetClipVertex(i1, numVaryings);
+    poly[0][2] = GetClipVertex(i2, numVaryings);
+
+    const uint32_t planes[] = { CP_NEAR, CP_FAR, CP_GB_LEFT, CP_GB_RIGHT, CP_GB_BOTTOM, CP_GB_TOP };
+    for (uint32_t plane: planes) {
+        if ((ocUnion & plane) == 0)
+            continue;
+
+        count = ClipPolygon(vp, plane, poly[src], count, poly[src ^ 1], numVaryings);
+        src ^= 1;
+
+        if (count < 3) {
+            stats.culledFrustum++;
+            return;
+        }
+    }
+
+    // triangle fan keeps the winding
+    for (int i = 1; i + 1 < count; ++i) {
+        const float* varyings[3] = { poly[src][0].varyings, poly[src][i].varyings, poly[src][i + 1].varyings };
+        EmitTriangle(ToScreenSpace(vp, poly[src][0]), ToScreenSpace(vp, poly[src][i]), ToScreenSpace(vp, poly[src][i + 1]), varyings);
     }
 }
 
 // FGL interface implementation
 void fglSetRenderTarget(FRenderTarget* rt)
 {
+    if (FCommand* cmd = RecordCommand(CT_SET_RENDER_TARGET)) {
+        cmd->renderTarget = rt;
+        return;
+    }
+
     g_drawContext.colorRT = rt;
+
+    if (rt != nullptr)
+        g_drawContext.viewport = SetupViewport(rt->width, rt->height);
 }
 
 void fglSetDepthStencilTarget(FRenderTarget* rt)
 {
+    if (FCommand* cmd = RecordCommand(CT_SET_DEPTH_STENCIL_TARGET)) {
+        cmd->renderTarget = rt;
+        return;
+    }
+
     g_drawContext.depthRT = rt;
 }
 
+void fglSetResolveTarget(FRenderTarget* rt)
+{
+    if (FCommand* cmd = RecordCommand(CT_SET_RESOLVE_TARGET)) {
+        cmd->renderTarget = rt;
+        return;
+    }
+
+    g_drawContext.resolveRT = rt;
+}
+
 void fglClear(uint32_t color, float depth)
 {
-    if (g_drawContext.IsValid()) {
-        std::memset(g_drawContext.colorRT->pixels, color, g_drawContext.colorRT->width * g_drawContext.colorRT->height * sizeof(TPixelARGB8));
-        //std::memset(g_drawContext.depthRT->pixels, *((int*)&depth), g_drawContext.depthRT->width * g_drawContext.depthRT->height * sizeof(TPixelDepth));
+    if (FCommand* cmd = RecordCommand(CT_CLEAR)) {
+        cmd->clear.color = color;
+        cmd->clear.depth = depth;
+        return;
+    }
 
-        float* pixels = reinterpret_cast<float*>(g_drawContext.depthRT->pixels);
-        for (ptrdiff_t i = 0; i < g_drawContext.depthRT->width * g_drawContext.depthRT->height; ++i)
-            pixels[i] = depth;
+    FFrame& frame = g_drawContext.RecordingFrame();
+    frame.clear      = true;
+    frame.clearColor = color;
+    frame.clearDepth = depth;
+}
+
+void fglInvalidateRenderTarget(FRenderTarget* rt)
+{
+    MarkTilesDirty(rt, 0, 0, rt->width, rt->height);
+}
+
+static F_INLINE void AppendToBin(FBinList& list, const FTriSetup* tri, FArena& arena)
+{
+    if (!list.tail || list.tail->count == F_BIN_BLOCK_SIZE) {
+        FBinBlock* block = arena.Allocate<FBinBlock>();
+        block->next  = nullptr;
+        block->count = 0;
+
+        if (list.tail)
+            list.tail->next = block;
+        else
+            list.head = block;
+        list.tail = block;
     }
+
+    list.tail->tris[list.tail->count++] = tri;
+}
+
+static void BinTriangles(FFrame& frame)
+{
+    F_NAMED_PROFILE(Bin_Triangles);
+
+    int width  = frame.colorRT->width;
+    int height = frame.colorRT->height;
+
+    uint32_t samples = frame.colorRT->samples;
+
+    int tilesX = (width  + F_TILE_SIZE - 1) / F_TILE_SIZE;
+    int tilesY = (height + F_TILE_SIZE - 1) / F_TILE_SIZE;
+    size_t numTiles = size_t(tilesX) * tilesY;
+
+    // one range per thread, but not less than a triangle block per range
+    size_t numThreads = g_drawContext.threadPool.GetThreadCount();
+    size_t numRanges  = (frame.numTriangles + F_TRIANGLE_BLOCK_SIZE - 1) / F_TRIANGLE_BLOCK_SIZE;
+    numRanges = numRanges < numThreads ? numRanges : numThreads;
+
+    g_drawContext.tilesX       = tilesX;
+    g_drawContext.tilesY       = tilesY;
+    g_drawContext.numBinRanges = numRanges;
+    g_drawContext.binLists.assign(numRanges * numTiles, FBinList{ nullptr, nullptr });
+
+    std::vector<FThreadArena>& arenas = g_drawContext.binArenas;
+    arenas.resize(numThreads);
+    for (FThreadArena& ta: arenas)
+        ta.arena.Reset();
+
+    g_drawContext.threadPool.ParallelFor(numRanges, [&frame, width, height, samples, tilesX, numTiles, numRanges](size_t range, uint32_t threadIndex) {
+        F_NAMED_PROFILE(Bin_Range);
+
+        FArena&   arena = g_drawContext.binArenas[threadIndex].arena;
+        FBinList* lists = &g_drawContext.binLists[range * numTiles];
+
+        size_t first = frame.numTriangles * range / numRanges;
+        size_t last  = frame.numTriangles * (range + 1) / numRanges;
+
+        // records are set up once here instead of in every tile the triangle touches,
+        // the one of a rejected triangle is reused when it's large enough
+        FTriSetup* setup     = nullptr;
+        size_t     setupSize = 0;
+
+        for (size_t i = first; i < last; ++i) {
+            const SSTri& tri = frame.triangleBlocks[i / F_TRIANGLE_BLOCK_SIZE]->tris[i % F_TRIANGLE_BLOCK_SIZE];
+
+            size_t size = GetTriSetupSize(tri.numVaryings);
+            if (!setup || setupSize < size) {
+                setup     = static_cast<FTriSetup*>(arena.Allocate(size, alignof(FTriSetup)));
+                setupSize = size;
+            }
+
+            if (!SetupTriangle(tri, width, height, samples, *setup))
+                continue;
+
+            int tx0 = setup->minx / F_TILE_SIZE;
+            int tx1 = (setup->maxx - 1) / F_TILE_SIZE;
+            int ty0 = setup->miny / F_TILE_SIZE;
+            int ty1 = (setup->maxy - 1) / F_TILE_SIZE;
+
+            for (int ty = ty0; ty <= ty1; ++ty) {
+                for (int tx = tx0; tx <= tx1; ++tx)
+                    AppendToBin(lists[ty * tilesX + tx], setup, arena);
+            }
+
+            setup     = nullptr;
+            setupSize = 0;
+        }
+    });
+}
+
+static void RasterizeTiles(FFrame& frame)
+{
+    F_NAMED_PROFILE(Rasterize_Triangles);
+
+    std::vector<FThreadStatistics>& threadStats = g_drawContext.threadStats;
+    threadStats.assign(g_drawContext.threadPool.GetThreadCount(), FThreadStatistics());
+
+    size_t numTiles = size_t(g_drawContext.tilesX) * g_drawContext.tilesY;
+
+    const FRenderTarget* resolveRT = frame.resolveRT;
+    bool resolve = frame.colorRT->samples > 1 && resolveRT != nullptr && resolveRT->pixelFormat == PF_ARGB8 && resolveRT->samples == 1 &&
+                   resolveRT->width == frame.colorRT->width && resolveRT->height == frame.colorRT->height;
+
+    // every tile owns its pixels, so workers never touch the same memory
+    g_drawContext.threadPool.ParallelFor(numTiles, [&frame, &threadStats, numTiles, resolve](size_t tile, uint32_t threadIndex) {
+        F_NAMED_PROFILE(Rasterize_Tile);
+
+        int tx = static_cast<int>(tile) % g_drawContext.tilesX;
+        int ty = static_cast<int>(tile) / g_drawContext.tilesX;
+
+        // clipped to the target, the blocks of the last tiles may cross its edge
+        FTileContext context;
+        context.colorRT              = frame.colorRT;
+        context.depthRT              = frame.depthRT;
+        context.rect                 = { tx * F_TILE_SIZE, ty * F_TILE_SIZE, imin((tx + 1) * F_TILE_SIZE, frame.colorRT->width), imin((ty + 1) * F_TILE_SIZE, frame.colorRT->height) };
+        context.computeBlockCoverage = g_computeBlockCoverage;
+        context.blendPixels          = g_blendPixels;
+        context.stats                = &threadStats[threadIndex].stats;
+        context.maxDepth             = 0.0F;
+        context.maxDepthDirty        = true;
+
+        bool empty = true;
+        for (size_t range = 0; range < g_drawContext.numBinRanges && empty; ++range)
+            empty = g_drawContext.binLists[range * numTiles + tile].head == nullptr;
+
+        if (empty) {
+            ResolveTile(frame.colorRT, tx, ty);
+            ResolveTile(frame.depthRT, tx, ty);
+        } else {
+            PrepareTile(frame.colorRT, tx, ty);
+            PrepareTile(frame.depthRT, tx, ty);
+
+            // ranges follow submission order
+            for (size_t range = 0; range < g_drawContext.numBinRanges; ++range) {
+                const FBinList& list = g_drawContext.binLists[range * numTiles + tile];
+
+                for (const FBinBlock* block = list.head; block; block = block->next)
+                    RasterizeTriangles(context, block->count, block->tris);
+            }
+        }
+
+        if (resolve)
+            ResolveMultisampleTile(frame.colorRT, frame.resolveRT, static_cast<int>(tile));
+    });
+
+    for (const FThreadStatistics& ts: threadStats) {
+        frame.stats.hizCulledTriangles += ts.stats.hizCulledTriangles;
+        frame.stats.hizCulledBlocks    += ts.stats.hizCulledBlocks;
+        frame.stats.blocksSkipped      += ts.stats.blocksSkipped;
+        frame.stats.blocksFull         += ts.stats.blocksFull;
+        frame.stats.blocksPartial      += ts.stats.blocksPartial;
+        frame.stats.fragmentsTested    += ts.stats.fragmentsTested;
+        frame.stats.pixelsWritten      += ts.stats.pixelsWritten;
+        frame.stats.fragmentsShaded    += ts.stats.fragmentsShaded;
+    }
+
+    float numPixels = static_cast<float>(frame.colorRT->width) * frame.colorRT->height;
+
+    frame.stats.depthFailed     = frame.stats.fragmentsTested - frame.stats.pixelsWritten;
+    frame.stats.depthComplexity = frame.stats.fragmentsTested / numPixels;
+    frame.stats.overdraw        = frame.stats.fragmentsShaded / numPixels;
+}
+
+// the raster stage, runs on the raster thread
+static void ExecuteFrame(FFrame& frame)
+{
+    if (frame.colorRT != nullptr && frame.depthRT != nullptr && frame.colorRT->samples == frame.depthRT->samples) {
+        if (frame.clear) {
+            F_NAMED_PROFILE(Clear_Targets);
+            FStageTimer timer(frame.stats.clearTime);
+
+            uint32_t depthBits;
+            std::memcpy(&depthBits, &frame.clearDepth, sizeof(depthBits));
+
+            RequestClear(frame.colorRT, frame.clearColor);
+            RequestClear(frame.depthRT, depthBits);
+        }
+
+        {
+            FStageTimer timer(frame.stats.binTime);
+            BinTriangles(frame);
+        }
+
+        {
+            FStageTimer timer(frame.stats.rasterTime);
+            RasterizeTiles(frame);
+        }
+
+        for (const FThreadArena& ta: g_drawContext.binArenas)
+            frame.stats.binMemory += ta.arena.GetUsedSize();
+    }
+
+    frame.stats.triangles      = frame.numTriangles;
+    frame.stats.triangleMemory = frame.triangleArena.GetUsedSize();
+
+    {
+        std::lock_guard<std::mutex> lock(g_drawContext.frameMutex);
+
+        uint64_t& triangleHighWater = g_drawContext.triangleMemoryHighWater;
+        uint64_t& binHighWater      = g_drawContext.binMemoryHighWater;
+        triangleHighWater = frame.stats.triangleMemory > triangleHighWater ? frame.stats.triangleMemory : triangleHighWater;
+        binHighWater      = frame.stats.binMemory      > binHighWater      ? frame.stats.binMemory      : binHighWater;
+
+        frame.stats.triangleMemoryHighWater = triangleHighWater;
+        frame.stats.binMemoryHighWater      = binHighWater;
+
+        g_drawContext.lastFrameStats = frame.stats;
+        g_drawContext.completedFrame = frame.handle;
+    }
+    g_drawContext.frameCondition.notify_all();
+}
+
+void fglSetThreadCount(uint32_t count)
+{
+    // the pool is used by the raster stage
+    fglWaitFrame(g_drawContext.lastFrame);
+
+    g_drawContext.threadPool.SetThreadCount(count);
+}
+
+uint32_t fglGetThreadCount()
+{
+    return g_drawContext.threadPool.GetThreadCount();
+}
+
+TFrameHandle fglPresentAsync()
+{
+    FFrame& frame = g_drawContext.RecordingFrame();
+    // frames without valid targets are dropped by the raster stage
+    frame.colorRT   = g_drawContext.IsValid() ? g_drawContext.colorRT : nullptr;
+    frame.depthRT   = g_drawContext.IsValid() ? g_drawContext.depthRT : nullptr;
+    frame.resolveRT = g_drawContext.resolveRT;
+    frame.handle    = ++g_drawContext.lastFrame;
+
+    // one frame rasterizes at a time, once the previous one is done its buffers can be reused
+    fglWaitFrame(frame.handle - 1);
+
+    g_drawContext.rasterThread.Enqueue([&frame] { ExecuteFrame(frame); });
+
+    g_drawContext.recordingFrame ^= 1;
+
+    FFrame& next = g_drawContext.RecordingFrame();
+    next.triangleArena.Reset();
+    next.triangleBlocks.clear();
+    next.numTriangles = 0;
+    next.clear = false;
+    next.stats = FPipelineStatistics();
+
+    // the constants were stored in the frame just handed over
+    g_drawContext.frameConstants = nullptr;
+
+    return frame.handle;
+}
+
+void fglWaitFrame(TFrameHandle frame)
+{
+    std::unique_lock<std::mutex> lock(g_drawContext.frameMutex);
+    g_drawContext.frameCondition.wait(lock, [frame] { return g_drawContext.completedFrame >= frame; });
 }
 
 void fglPresent()
 {
-    if (g_drawContext.IsValid())
-        RasterizeTriangles(g_drawContext.colorRT, g_drawContext.depthRT, g_drawContext.screenTris.size(), g_drawContext.screenTris.data());
+    fglWaitFrame(fglPresentAsync());
+}
+
+void fglReserveFrameMemory(size_t triangleBytes, size_t binBytes)
+{
+    // the bin arenas belong to the raster stage
+    fglWaitFrame(g_drawContext.lastFrame);
+
+    for (FFrame& frame: g_drawContext.frames)
+        frame.triangleArena.Reserve(triangleBytes);
 
-    // always clear
-    g_drawContext.screenTris.clear();
+    std::vector<FThreadArena>& arenas = g_drawContext.binArenas;
+    arenas.resize(g_drawContext.threadPool.GetThreadCount());
+    for (FThreadArena& ta: arenas)
+        ta.arena.Reserve(binBytes / arenas.size());
+}
+
+void fglGetPipelineStatistics(FPipelineStatistics* stats)
+{
+    std::lock_guard<std::mutex> lock(g_drawContext.frameMutex);
+    *stats = g_drawContext.lastFrameStats;
 }
 
 void fglSetMatrix(EDrawMatrix matrix, TDrawMatrix drawMatrix)
 {
+    if (FCommand* cmd = RecordCommand(CT_SET_MATRIX)) {
+        cmd->setMatrix.matrix = matrix;
+        std::memcpy(cmd->setMatrix.value, drawMatrix, 16 * sizeof(float));
+        return;
+    }
+
     std::memcpy(g_drawContext.matrices[matrix], drawMatrix, 16 * sizeof(float));
     if (matrix == DM_MODELVIEW) {
         MMul(g_drawContext.matrices[DM_PROJECTION], drawMatrix, g_drawContext.MVP);
     }
 }
 
+void fglSetCullMode(ECullMode mode)
+{
+    if (FCommand* cmd = RecordCommand(CT_SET_CULL_MODE)) {
+        cmd->cullMode = mode;
+        return;
+    }
+
+    g_drawContext.cullMode = mode;
+}
+
+void fglSetDepthState(const FDepthState& state)
+{
+    if (FCommand* cmd = RecordCommand(CT_SET_DEPTH_STATE)) {
+        cmd->depthState = state;
+        return;
+    }
+
+    g_drawContext.depthState = state;
+}
+
+void fglSetColorWrite(bool enable)
+{
+    if (FCommand* cmd = RecordCommand(CT_SET_COLOR_WRITE)) {
+        cmd->colorWrite = enable;
+        return;
+    }
+
+    g_drawContext.colorWrite = enable;
+}
+
+void fglSetBlendState(const FBlendState& state)
+{
+    if (FCommand* cmd = RecordCommand(CT_SET_BLEND_STATE)) {
+        cmd->blendState = state;
+        return;
+    }
+
+    g_drawContext.blendState = state;
+}
+
+void fglSetPipeline(const FPipeline* pipeline)
+{
+    if (FCommand* cmd = RecordCommand(CT_SET_PIPELINE)) {
+        cmd->pipeline = pipeline;
+        return;
+    }
+
+    g_drawContext.pipeline = pipeline;
+}
+
+void fglSetShaderConstants(const void* data, size_t size)
+{
+    if (FCommand* cmd = RecordCommand(CT_SET_SHADER_CONSTANTS)) {
+        cmd->shaderConstants.offset = RecordCommandData(data, size);
+        cmd->shaderConstants.size   = size;
+        return;
+    }
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    g_drawContext.constants.assign(bytes, bytes + size);
+    g_drawContext.frameConstants = nullptr;
+}
+
+void fglSetTexture(FTexture* tex)
+{
+    if (FCommand* cmd = RecordCommand(CT_SET_TEXTURE)) {
+        cmd->texture = tex;
+        return;
+    }
+
+    g_drawContext.texture = tex;
+}
+
+void fglSetSamplerState(const FSamplerState& state)
+{
+    if (FCommand* cmd = RecordCommand(CT_SET_SAMPLER_STATE)) {
+        cmd->samplerState = state;
+        return;
+    }
+
+    g_drawContext.sampler = state;
+}
+
+void fglSetVertexFormat(const FVertexFormat* format)
+{
+    if (FCommand* cmd = RecordCommand(CT_SET_VERTEX_FORMAT)) {
+        cmd->vertexFormat = format;
+        return;
+    }
+
+    g_drawContext.vertexFormat = format;
+}
+
+void fglSetVertexStream(uint32_t stream, FVertexBuffer* vbuf)
+{
+    if (FCommand* cmd = RecordCommand(CT_SET_VERTEX_STREAM)) {
+        cmd->vertexStream.stream = stream;
+        cmd->vertexStream.buffer = vbuf;
+        return;
+    }
+
+    if (stream < F_MAX_VERTEX_STREAMS)
+        g_drawContext.vertexStreams[stream] = vbuf;
+}
+
 void fglSetVertexBuffer(FVertexBuffer* vbuf)
 {
-    g_drawContext.vertexBuffer = vbuf;
+    fglSetVertexStream(0, vbuf);
 }
 
 void fglSetIndexBuffer(FIndexBuffer* ibuf)
 {
+    if (FCommand* cmd = RecordCommand(CT_SET_INDEX_BUFFER)) {
+        cmd->indexBuffer = ibuf;
+        return;
+    }
+
     g_drawContext.indexBuffer = ibuf;
 }
 
+// Resolves the vertex format against the streams and the pipeline, and copies the shader constants into the recording frame,
+// where the raster stage reads them. Returns the number of vertices in every stream the format uses, 0 when one isn't bound.
+static size_t BeginDraw()
+{
+    const FVertexFormat* format = g_drawContext.vertexFormat ? g_drawContext.vertexFormat : g_fixedVertexFormat;
+
+    size_t numVertices = SIZE_MAX;
+    for (uint32_t stream = 0; stream < F_MAX_VERTEX_STREAMS; ++stream) {
+        const FVertexBuffer* vbuf = g_drawContext.vertexStreams[stream];
+        if (!(format->streamMask & (1u << stream)))
+            continue;
+        if (!vbuf)
+            return 0;
+
+        numVertices = vbuf->size < numVertices ? vbuf->size : numVertices;
+    }
+
+    FVertexFetch& fetch = g_drawContext.vertexFetch;
+    fetch.numAttributes = 0;
+    std::fill(fetch.zeros, fetch.zeros + 4, 0.0F);
+
+    for (uint32_t semantic = 0; semantic < VS_COUNT; ++semantic) {
+        const FVertexElement& e = format->elements[semantic];
+        if (e.components == 0)
+            continue;
+
+        const FVertexBuffer* vbuf = g_drawContext.vertexStreams[e.stream];
+        fetch.semantics[fetch.numAttributes] = semantic;
+        fetch.data[fetch.numAttributes]      = vbuf->data + e.offset;
+        fetch.strides[fetch.numAttributes]   = vbuf->stride;
+        fetch.numAttributes++;
+
+        if (semantic == VS_POSITION) {
+            g_drawContext.positions      = reinterpret_cast<const float*>(vbuf->data + e.offset);
+            g_drawContext.positionStride = vbuf->stride / sizeof(float);
+        }
+    }
+
+    const FPipeline* pipeline = g_drawContext.pipeline;
+    if (!pipeline)
+        pipeline = g_drawContext.texture ? g_texturedPipeline : g_untexturedPipeline;
+
+    g_drawContext.drawPipeline = pipeline;
+
+    const std::vector<uint8_t>& constants = g_drawContext.constants;
+    if (!g_drawContext.frameConstants && !constants.empty()) {
+        void* copy = g_drawContext.RecordingFrame().triangleArena.Allocate(constants.size(), 16);
+        std::memcpy(copy, constants.data(), constants.size());
+        g_drawContext.frameConstants = copy;
+    }
+
+    return numVertices;
+}
+
 void fglDraw(size_t offset, size_t count)
 {
+    if (FCommand* cmd = RecordCommand(CT_DRAW)) {
+        cmd->draw.offset = offset;
+        cmd->draw.count = count;
+        return;
+    }
+
     F_NAMED_PROFILE(Vertex_Processing);
+    FStageTimer timer(g_drawContext.RecordingFrame().stats.vertexTime);
 
-    for (size_t idx = offset; idx < count; idx += 3) {
-        const FVertexBuffer::FixedVertex& v0 = g_drawContext.vertexBuffer->data[idx + 0];
-        const FVertexBuffer::FixedVertex& v1 = g_drawContext.vertexBuffer->data[idx + 1];
-        const FVertexBuffer::FixedVertex& v2 = g_drawContext.vertexBuffer->data[idx + 2];
+    size_t numVertices = BeginDraw();
+    if (numVertices == 0)
+        return;
 
-        WSTri tri{ v2, v1, v0 };
-        ProjectTriangle(tri);
-    }
+    count -= count % 3;
+    g_drawContext.RecordingFrame().stats.trianglesSubmitted += count / 3;
+    g_drawContext.vertexCache.Reserve(numVertices);
+    TransformVertices(offset, count);
+
+    for (size_t idx = offset; idx < offset + count; idx += 3)
+        ProjectTriangle(idx + 2, idx + 1, idx + 0);
 }
 
 void fglDrawIndexed(size_t offset, size_t count)
 {
+    if (FCommand* cmd = RecordCommand(CT_DRAW_INDEXED)) {
+        cmd->draw.offset = offset;
+        cmd->draw.count = count;
+        return;
+    }
+
     F_NAMED_PROFILE(Vertex_Processing);
+    FStageTimer timer(g_drawContext.RecordingFrame().stats.vertexTime);
+
+    count -= count % 3;
+    if (count == 0)
+        return;
+
+    size_t numVertices = BeginDraw();
+    if (numVertices == 0)
+        return;
+
+    g_drawContext.RecordingFrame().stats.trianglesSubmitted += count / 3;
+
+    const FIndexBuffer::FixedIndex* indices = g_drawContext.indexBuffer->data + offset;
+
+    FIndexBuffer::FixedIndex minIndex = indices[0];
+    FIndexBuffer::FixedIndex maxIndex = indices[0];
+    for (size_t i = 1; i < count; ++i) {
+        minIndex = indices[i] < minIndex ? indices[i] : minIndex;
+        maxIndex = indices[i] > maxIndex ? indices[i] : maxIndex;
+    }
+
+    FVertexCache& cache = g_drawContext.vertexCache;
+    cache.Reserve(numVertices);
+
+    // transform the referenced range in bulk unless it is mostly unused
+    size_t range = size_t(maxIndex - minIndex) + 1;
+    bool   dense = range <= count;
+
+    if (dense)
+        TransformVertices(minIndex, range);
+    else
+        cache.BeginSparseDraw();
 
-    for (size_t idx = offset; idx < count; idx += 3) {
-        const FVertexBuffer::FixedVertex& v0 = g_drawContext.vertexBuffer->data[g_drawContext.indexBuffer->data[idx + 0]];
-        const FVertexBuffer::FixedVertex& v1 = g_drawContext.vertexBuffer->data[g_drawContext.indexBuffer->data[idx + 1]];
-        const FVertexBuffer::FixedVertex& v2 = g_drawContext.vertexBuffer->data[g_drawContext.indexBuffer->data[idx + 2]];
+    for (size_t idx = 0; idx < count; idx += 3) {
+        FIndexBuffer::FixedIndex i0 = indices[idx + 0];
+        FIndexBuffer::FixedIndex i1 = indices[idx + 1];
+        FIndexBuffer::FixedIndex i2 = indices[idx + 2];
 
-        WSTri tri{ v2, v1, v0 };
-        ProjectTriangle(tri);
+        if (!dense) {
+            FetchVertex(i0);
+            FetchVertex(i1);
+            FetchVertex(i2);
+        }
+
+        ProjectTriangle(i2, i1, i0);
     }
 }
 
 void fglDrawDebugText(FRenderTarget* rt, const char* text, int x, int y)
 {
+    MarkTilesDirty(rt, x, y, x + 8 * static_cast<int>(strlen(text)), y + 8);
+
     int dx = x;
     int dy = y;
 
@@ -586,3 +1756,40 @@ void fglDrawDebugText(FRenderTarget* rt, const char* text, int x, int y)
         dx += 8;
     }
 }
+
+int fglDrawPipelineStatistics(FRenderTarget* rt, const FPipelineStatistics& stats, int x, int y)
+{
+    char buf[128];
+    const struct { const char* name; uint64_t value; } counters[] = {
+        { "triangles submitted", stats.trianglesSubmitted },
+        { "vertices",            stats.verticesTransformed },
+        { "culled frustum",      stats.culledFrustum },
+        { "clipped",             stats.clippedTriangles },
+        { "culled back face",    stats.culledBackFace },
+        { "culled degenerate",   stats.culledDegenerate },
+        { "triangles rastered",  stats.triangles },
+        { "hiz culled tris",     stats.hizCulledTriangles },
+        { "hiz culled blocks",   stats.hizCulledBlocks },
+        { "blocks skipped",      stats.blocksSkipped },
+        { "blocks full",         stats.blocksFull },
+        { "blocks partial",      stats.blocksPartial },
+        { "depth tested",        stats.fragmentsTested },
+        { "depth passed",        stats.pixelsWritten },
+        { "depth failed",        stats.depthFailed },
+        { "shaded",              stats.fragmentsShaded },
+    };
+
+    for (const auto& counter: counters) {
+        snprintf(buf, sizeof(buf), "%-20s %llu", counter.name, static_cast<unsigned long long>(counter.value));
+        fglDrawDebugText(rt, buf, x, y);
+        y += 8;
+    }
+
+    snprintf(buf, sizeof(buf), "%-20s %.2f", "depth complexity", stats.depthComplexity);
+    fglDrawDebugText(rt, buf, x, y);
+    y += 8;
+
+    snprintf(buf, sizeof(buf), "%-20s %.2f", "overdraw", stats.overdraw);
+    fglDrawDebugText(rt, buf, x, y);
+    return y + 8;
+}
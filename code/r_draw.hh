@@ -9,36 +9,111 @@ enum EPixelFormat
     PF_DEPTH
 };
 
+#define F_MSAA_SAMPLES 4
+
 struct FRenderTarget
 {
     int32_t        width; // made signed for easier triangle clipping
     int32_t        height;
     EPixelFormat   pixelFormat;
+    uint32_t       samples; // 1 or F_MSAA_SAMPLES
     unsigned char* pixels;
+    float*         blockMaxDepth; // PF_DEPTH only, max depth of every 8x8 block for early rejection
+
+    // Multisampled PF_DEPTH targets store every sample, pixel by pixel. Multisampled PF_ARGB8 targets keep one
+    // color in pixels while all samples of a pixel are equal, pixels an edge crosses are flagged and hold their
+    // colors in samplePixels instead. Resolve them into a single-sample target to display them.
+    uint8_t*       sampleFlags;  // per pixel, nonzero when samplePixels holds it
+    uint32_t*      samplePixels; // samples of every pixel, one after another
+
+    // Clears are lazy: every screen tile of the raster stage remembers whether it still holds clearValue,
+    // the raw bits of the last clear color or depth. Tiles are filled when first drawn into or at the end of the frame.
+    uint8_t*       tileState;
+    uint32_t       clearValue;
 
     static FRenderTarget* Allocate(uint32_t width, uint32_t height, EPixelFormat format);
+    static FRenderTarget* Allocate(uint32_t width, uint32_t height, EPixelFormat format, uint32_t samples); // returns nullptr for other sample counts
     static void           Release(FRenderTarget* rt);
 };
 
+#define F_ARGB(a, r, g, b) ((a << 24) | (r << 16) | (g << 8) | (b << 0))
+
+#define F_MAX_TEXTURE_LEVELS 16
+
+// ARGB8 texture with a full mip chain, texels are stored swizzled in cache-line sized tiles
+struct FTexture
+{
+    uint32_t  width;
+    uint32_t  height;
+    uint32_t  numLevels;
+    uint32_t* texels;
+    size_t    levelOffset[F_MAX_TEXTURE_LEVELS]; // in texels
+
+    static FTexture* Allocate(uint32_t width, uint32_t height, const uint32_t* data); // data is row-major and copied, returns nullptr unless both dimensions are powers of two
+    static void      Release(FTexture* tex);
+};
+
+enum ETextureFilter
+{
+    TF_NEAREST   = 0, // nearest texel of the nearest mip level
+    TF_BILINEAR  = 1, // 2x2 texels of the nearest mip level
+    TF_TRILINEAR = 2  // 2x2 texels of the two nearest mip levels
+};
+
+enum ETextureAddress
+{
+    TA_WRAP  = 0,
+    TA_CLAMP = 1
+};
+
+struct FSamplerState
+{
+    ETextureFilter  filter;
+    ETextureAddress addressU;
+    ETextureAddress addressV;
+};
+
 enum EVertexSemantic
 {
-    VS_POSITION  = 0, // used, always 3 floats
-    VS_TEXCOORD0 = 1, // used, always 2 floats
-    VS_TEXCOORD1 = 2, // all below not used
+    VS_POSITION  = 0, // always 3 floats, transformed by the MVP matrix
+    VS_TEXCOORD0 = 1, // 2 floats for the built-in pipeline
+    VS_TEXCOORD1 = 2, // the rest is up to the shaders
     VS_TEXCOORD2 = 3,
     VS_TEXCOORD3 = 4,
     VS_TEXCOORD4 = 5,
     VS_TEXCOORD5 = 6,
     VS_TEXCOORD6 = 7,
     VS_TEXCOORD7 = 8,
+    VS_NORMAL    = 9,
 
     VS_COUNT
 };
 
-struct FVertexFormat {}; // dummy structure, VF is always VS_POSITION+VS_TEXCOORD
+#define F_MAX_VERTEX_STREAMS 4
+
+// where an attribute is stored, attributes are floats
+struct FVertexElement
+{
+    EVertexSemantic semantic;
+    uint32_t        stream;     // vertex buffer slot, below F_MAX_VERTEX_STREAMS
+    uint32_t        offset;     // bytes from the start of a vertex, multiple of 4
+    uint32_t        components; // 1 to 4
+};
+
+// Layout of the vertices, attributes can be interleaved in one stream or spread over several.
+// Shaders read them by semantic, the ones the format doesn't have read as zeros.
+struct FVertexFormat
+{
+    FVertexElement elements[VS_COUNT]; // by semantic, components is 0 when missing
+    uint32_t       streamMask;        // bit per stream the elements read from
+
+    static FVertexFormat* Allocate(const FVertexElement* elements, size_t count); // returns nullptr without a 3 float VS_POSITION or with an invalid element
+    static void           Release(FVertexFormat* format);
+};
 
 struct FVertexBuffer
 {
+    // vertex of the default format, position, texcoord 0 and normal in stream 0
     struct FixedVertex
     {
         float vs_position[3];
@@ -46,10 +121,12 @@ struct FVertexBuffer
         float vs_normal[3];
     };
 
-    FixedVertex* data;
-    size_t       size;
+    uint8_t* data;
+    size_t   size;   // in vertices
+    uint32_t stride; // in bytes
 
     static FVertexBuffer* Allocate(FixedVertex* data, size_t size); // will NOT take ownership of data
+    static FVertexBuffer* Allocate(void* data, size_t size, uint32_t stride); // same, returns nullptr unless stride is a multiple of 4
     static void           Release(FVertexBuffer* buffer);
 };
 
@@ -74,20 +151,202 @@ enum EDrawMatrix
 
 typedef float TDrawMatrix[16];
 
+// winding is the order the vertices were submitted in, as seen in normalized device coordinates (y up)
+enum ECullMode
+{
+    CM_NONE = 0,
+    CM_CW   = 1, // cull clockwise triangles, the default
+    CM_CCW  = 2  // cull counter-clockwise triangles
+};
+
+enum EDepthFunc // passes when the fragment's depth compares to the stored one like this
+{
+    DF_LESS       = 0, // the default
+    DF_LESS_EQUAL = 1,
+    DF_EQUAL      = 2, // shading pass after a depth prepass
+    DF_ALWAYS     = 3
+};
+
+struct FDepthState
+{
+    EDepthFunc func;
+    bool       write;
+};
+
+enum EBlendFactor // scales a term of the blend per channel, alpha included
+{
+    BF_ZERO          = 0,
+    BF_ONE           = 1,
+    BF_SRC_COLOR     = 2,
+    BF_INV_SRC_COLOR = 3,
+    BF_SRC_ALPHA     = 4,
+    BF_INV_SRC_ALPHA = 5,
+    BF_DST_COLOR     = 6,
+    BF_INV_DST_COLOR = 7,
+    BF_DST_ALPHA     = 8,
+    BF_INV_DST_ALPHA = 9
+};
+
+enum EBlendOp // combines the shaded color times src with the stored one times dst, clamped to 0..255
+{
+    BO_ADD              = 0,
+    BO_SUBTRACT         = 1, // src term minus dst term
+    BO_REVERSE_SUBTRACT = 2, // dst term minus src term
+    BO_MIN              = 3, // the factors are ignored
+    BO_MAX              = 4
+};
+
+struct FBlendState
+{
+    bool         enable;
+    EBlendFactor src;
+    EBlendFactor dst;
+    EBlendOp     op;
+};
+
+// counters of the last completed frame, cheap enough to stay on: the raster stage counts per block, not per pixel
+struct FPipelineStatistics
+{
+    uint64_t trianglesSubmitted;      // triangles of the draw calls, before culling and clipping
+    uint64_t verticesTransformed;     // vertex shader invocations, shared indexed vertices count once per draw
+    uint64_t culledFrustum;           // triangles outside the view volume, trivially rejected or clipped away
+    uint64_t clippedTriangles;        // triangles that crossed a clip plane, each one may emit several
+    uint64_t culledBackFace;          // triangles removed by the cull mode
+    uint64_t culledDegenerate;        // zero-area triangles and triangles not covering any pixel center or sample
+
+    uint64_t hizCulledTriangles;      // triangles rejected for a whole tile by hierarchical Z
+    uint64_t hizCulledBlocks;         // 8x8 blocks rejected by hierarchical Z
+
+    uint64_t blocksSkipped;           // 8x8 blocks in a triangle's bounds but outside one of its edges
+    uint64_t blocksFull;              // 8x8 blocks entirely inside a triangle
+    uint64_t blocksPartial;           // 8x8 blocks crossed by an edge, coverage evaluated per pixel
+
+    uint64_t triangleMemory;          // bytes of per-frame triangle storage
+    uint64_t triangleMemoryHighWater; // most triangle storage any frame so far needed
+    uint64_t binMemory;               // bytes of per-frame tile bins and triangle setup records, all threads together
+    uint64_t binMemoryHighWater;
+
+    uint64_t triangles;               // triangles handed to the raster stage after culling and clipping
+    uint64_t fragmentsTested;         // covered pixels that reached the depth test, multisampled ones count once
+    uint64_t pixelsWritten;           // pixels that passed the depth test with at least one sample
+    uint64_t depthFailed;             // pixels that failed the depth test
+    uint64_t fragmentsShaded;         // pixels shaded and written to the color target
+
+    float    depthComplexity;         // fragments tested per target pixel
+    float    overdraw;                // fragments shaded per target pixel, 1 means every pixel was shaded once
+
+    float    vertexTime;              // milliseconds spent in draw calls, including culling and clipping
+    float    clearTime;               // milliseconds of the raster stage, per step, tiles are filled during rasterization
+    float    binTime;
+    float    rasterTime;
+};
+
+struct FCommand;
+
+// fgl calls recorded between fglBeginCommandBuffer and fglEndCommandBuffer, executed by fglSubmit
+struct FCommandBuffer
+{
+    FCommand* commands;
+    size_t    size;
+    size_t    capacity;
+
+    // arguments of the commands that were passed by pointer
+    uint8_t*  data;
+    size_t    dataSize;
+    size_t    dataCapacity;
+
+    static FCommandBuffer* Allocate();
+    static void            Release(FCommandBuffer* cb);
+};
+
+// identifies a presented frame, handles increase by one every frame starting from 1
+typedef uint64_t TFrameHandle;
+
 // the API
+// the depth target has to be at least as large as the color target, frames presented otherwise aren't rasterized
 void fglSetRenderTarget(FRenderTarget* rt);
-void fglSetDepthStencilTarget(FRenderTarget* rt);
-void fglClear(uint32_t color, float depth);
-void fglPresent();
+void fglSetDepthStencilTarget(FRenderTarget* rt); // must have the sample count of the render target
+
+// Multisampled render targets are resolved into this single-sample PF_ARGB8 target of the same size at present,
+// tile by tile right after rasterizing. nullptr, the default, skips the resolve.
+void fglSetResolveTarget(FRenderTarget* rt);
+void fglClear(uint32_t color, float depth); // applied to the targets bound at present, before any triangle of the frame
+
+// call after writing a target's pixels directly, otherwise the next clear may skip tiles it thinks still hold the clear value
+void fglInvalidateRenderTarget(FRenderTarget* rt);
+
+// Frames are processed in two stages: the draw calls transform and set up triangles on the calling thread,
+// presenting hands them over to a background raster stage. fglPresentAsync returns right away, so the next
+// frame can be submitted while this one rasterizes. Its targets, textures and the buffers it used must stay
+// untouched until fglWaitFrame returns for it. One frame rasterizes at a time, presenting waits for the previous.
+TFrameHandle fglPresentAsync();
+void         fglWaitFrame(TFrameHandle frame);
+void         fglPresent(); // present and wait
+
+// number of threads used for rasterization including the calling one, 0 means all hardware threads
+void     fglSetThreadCount(uint32_t count);
+uint32_t fglGetThreadCount();
+
+void fglGetPipelineStatistics(FPipelineStatistics* stats);
+
+// Presizes the per-frame storage so that no frame below these sizes touches the heap, the high-water marks
+// in FPipelineStatistics tell what's needed. The storage grows on its own otherwise, and settles on the
+// high-water size after a frame outgrows it. binBytes is shared by the rasterizer threads.
+void fglReserveFrameMemory(size_t triangleBytes, size_t binBytes);
 
 // the last set matrix should be EDM_MODELVIEW, because this function caches MVP matrix once modelview matrix is set
 void fglSetMatrix(EDrawMatrix matrix, TDrawMatrix drawMatrix);
 
-void fglSetVertexBuffer(FVertexBuffer* vbuf);
+void fglSetCullMode(ECullMode mode);
+
+// DF_LESS with depth writes by default
+void fglSetDepthState(const FDepthState& state);
+
+// Color writes are on by default. Draws without them only test and write depth and skip texturing entirely,
+// a depth prepass followed by a DF_EQUAL pass without depth writes shades every pixel once.
+void fglSetColorWrite(bool enable);
+
+// Off by default. Every tile draws its triangles in submission order on one thread, so blended draws give
+// the same image with any thread count. Draw translucent geometry after the opaque one, back to front.
+void fglSetBlendState(const FBlendState& state);
+
+// floats a vertex shader can pass to the pixel shader
+#define F_MAX_VARYINGS 8
+
+struct FPipeline; // r_shader.hh
+
+// nullptr selects the built-in pipeline, which samples the bound texture at the vertex texcoords
+void fglSetPipeline(const FPipeline* pipeline);
+
+// copied, the shaders of the following draws read them until they're set again
+void fglSetShaderConstants(const void* data, size_t size);
+
+// nullptr draws untextured white triangles
+void fglSetTexture(FTexture* tex);
+void fglSetSamplerState(const FSamplerState& state); // TF_NEAREST and TA_WRAP by default
+
+// nullptr selects the FixedVertex layout
+void fglSetVertexFormat(const FVertexFormat* format);
+
+// draws read vertex i of every stream the format uses, the streams must hold the vertices the draw references
+void fglSetVertexStream(uint32_t stream, FVertexBuffer* vbuf);
+void fglSetVertexBuffer(FVertexBuffer* vbuf); // stream 0
 void fglSetIndexBuffer(FIndexBuffer* ibuf);
 
 void fglDraw(size_t offset, size_t count);
 void fglDrawIndexed(size_t offset, size_t count);
 
+// Command buffers. While the calling thread records a buffer, the state setters, fglClear and
+// the draws are appended to it instead of executing, other calls stay immediate.
+// Each thread records its own buffer, so several can be recorded in parallel.
+void fglBeginCommandBuffer(FCommandBuffer* cb); // discards the previous contents
+void fglEndCommandBuffer();
+
+// executes the buffers one after another on the calling thread, as if their calls were made here
+void fglSubmit(FCommandBuffer* const* cbs, size_t count);
+
 // debug font
 void fglDrawDebugText(FRenderTarget* rt, const char* text, int x, int y);
+
+// the counters of stats, one line each, returns the y below the last line
+int fglDrawPipelineStatistics(FRenderTarget* rt, const FPipelineStatistics& stats, int x, int y);
@@ -0,0 +1,841 @@
+#pragma once
+
+#include "r_draw.hh"
+#include "r_coverage.hh"
+#include "r_sampler.hh"
+#include "r_blend.hh"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef F_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <climits>
+
+// Rasterizer inner loops, templated on the shader and the depth and color state of a pipeline so that
+// every combination is compiled without per-pixel branches. Included through r_shader.hh.
+
+//#define F_RASTERIZER_VIZ_COVERAGE
+#ifdef F_RASTERIZER_VIZ_COVERAGE
+#define FULL_COVERED_COLOR 0x000000FF
+#define PARTIALLY_COVERED_COLOR 0x00FF0000
+#endif
+
+// utils
+static F_INLINE int imin(int x, int y) { return y + ((x - y) & ((x - y) >> (sizeof(int) * CHAR_BIT - 1))); }
+static F_INLINE int imax(int x, int y) { return x - ((x - y) & ((x - y) >> (sizeof(int) * CHAR_BIT - 1))); }
+
+static F_INLINE int imin3(int x, int y, int z) { return imin(x, imin(y, z)); }
+static F_INLINE int imax3(int x, int y, int z) { return imax(x, imax(y, z)); }
+
+static F_INLINE int iclamp(int x, int a, int b) { return imin(imax(x, a), b); }
+
+static F_INLINE int iround(float x) { return static_cast<int>(x); }
+//static F_INLINE int iround(float x)
+//{
+//    int t;
+//    __asm
+//    {
+//        fld x
+//        fistp t
+//    }
+//    return t;
+//}
+
+static F_INLINE float fround(int x) { return static_cast<float>(x); }
+
+static F_INLINE int CountTrailingZeros(uint64_t x) // x must not be 0
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+static F_INLINE int PopCount(uint64_t x)
+{
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(x));
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+// pixel formats
+typedef uint32_t TPixelARGB8;
+typedef float    TPixelDepth;
+
+template <typename F>
+static F_INLINE void WritePixel(FRenderTarget*rt, size_t x, size_t y, F pixel)
+{
+    F* pixels = reinterpret_cast<F*>(rt->pixels);
+    pixels[y * rt->width + x] = pixel;
+}
+
+template <typename F>
+static F_INLINE F GetPixel(FRenderTarget* rt, size_t x, size_t y)
+{
+    F* pixels = reinterpret_cast<F*>(rt->pixels);
+    return pixels[y * rt->width + x];
+}
+
+// hierarchical Z, PF_DEPTH targets keep the max depth of every 8x8 block
+static F_INLINE int GetDepthBlocksX(const FRenderTarget* rt) { return (rt->width + 7) >> 3; }
+static F_INLINE int GetDepthBlocksY(const FRenderTarget* rt) { return (rt->height + 7) >> 3; }
+
+static F_INLINE float& GetBlockMaxDepth(FRenderTarget* rt, int x, int y)
+{
+    return rt->blockMaxDepth[(y >> 3) * GetDepthBlocksX(rt) + (x >> 3)];
+}
+
+static F_INLINE void UpdateBlockMaxDepth(FRenderTarget* rt, int x, int y) // x and y are block-aligned
+{
+    // the samples of a pixel are stored next to each other, multisampled rows are just longer
+    const int samples = static_cast<int>(rt->samples);
+    const int stride  = rt->width * samples;
+
+    int x0 = x * samples;
+    int x1 = imin(x + 8, rt->width) * samples;
+    int y1 = imin(y + 8, rt->height);
+
+    const TPixelDepth* pixels = reinterpret_cast<const TPixelDepth*>(rt->pixels);
+
+    TPixelDepth maxDepth = pixels[size_t(y) * stride + x0];
+    for (int iy = y; iy < y1; ++iy) {
+        const TPixelDepth* row = pixels + size_t(iy) * stride;
+        for (int ix = x0; ix < x1; ++ix)
+            maxDepth = row[ix] > maxDepth ? row[ix] : maxDepth;
+    }
+
+    GetBlockMaxDepth(rt, x, y) = maxDepth;
+}
+
+static F_INLINE float ComputeMaxDepth(FRenderTarget* rt, int x0, int y0, int x1, int y1) // over the blocks in [x0, x1) x [y0, y1)
+{
+    x1 = imin(x1, rt->width);
+    y1 = imin(y1, rt->height);
+
+    float maxDepth = GetBlockMaxDepth(rt, x0, y0);
+    for (int y = y0; y < y1; y += 8) {
+        for (int x = x0; x < x1; x += 8) {
+            float blockMax = GetBlockMaxDepth(rt, x, y);
+            maxDepth = blockMax > maxDepth ? blockMax : maxDepth;
+        }
+    }
+
+    return maxDepth;
+}
+
+// Hierarchical Z rejects when the nearest depth of a triangle can't pass against the farthest stored depth.
+// The tests that accept equal depths only reject strictly farther triangles, so a DF_EQUAL pass survives its prepass.
+template <EDepthFunc Func>
+static F_INLINE bool DepthBoundRejects(float minDepth, float maxStored)
+{
+    if (Func == DF_LESS)
+        return minDepth >= maxStored;
+    if (Func == DF_LESS_EQUAL || Func == DF_EQUAL)
+        return minDepth > maxStored;
+    return false;
+}
+
+// Early depth test, runs before any varying is interpolated. Returns true when the pixel passed,
+// the caller then queues it for shading unless color writes are off.
+template <EDepthFunc Func, bool DepthWrite>
+static F_INLINE bool TestTriPixel(FRenderTarget* depthRT, int x, int y, float bdepth)
+{
+    if (Func == DF_ALWAYS && !DepthWrite)
+        return true;
+
+    TPixelDepth& depth = reinterpret_cast<TPixelDepth*>(depthRT->pixels)[y * depthRT->width + x];
+
+    bool passed = Func == DF_LESS       ? bdepth <  depth :
+                  Func == DF_LESS_EQUAL ? bdepth <= depth :
+                  Func == DF_EQUAL      ? bdepth == depth : true;
+    if (!passed)
+        return false;
+
+    if (DepthWrite)
+        depth = bdepth;
+    return true;
+}
+
+// 4x rotated grid, offsets of the samples from the pixel center in 28.4
+static const int g_sampleOffsets[F_MSAA_SAMPLES][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+
+#define F_SAMPLE_EXTENT 6 // farthest any sample is from its pixel center along x or y, in 28.4
+
+// Early depth test of the covered samples of a multisampled pixel, returns the ones that passed.
+// sampleDepth holds the offsets of the depth plane from the pixel center to the samples.
+template <EDepthFunc Func, bool DepthWrite>
+static F_INLINE uint32_t TestTriSamples(FRenderTarget* depthRT, int x, int y, float bdepth, const float* sampleDepth, uint32_t coverage)
+{
+    if (Func == DF_ALWAYS && !DepthWrite)
+        return coverage;
+
+    TPixelDepth* depth = reinterpret_cast<TPixelDepth*>(depthRT->pixels) + (size_t(y) * depthRT->width + x) * F_MSAA_SAMPLES;
+
+#ifdef F_SIMD_SSE2
+    // the four samples of the pixel are next to each other
+    const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+
+    __m128 stored = _mm_loadu_ps(depth);
+    __m128 sdepth = _mm_add_ps(_mm_set1_ps(bdepth), _mm_loadu_ps(sampleDepth));
+    __m128 pass   = Func == DF_LESS       ? _mm_cmplt_ps(sdepth, stored) :
+                    Func == DF_LESS_EQUAL ? _mm_cmple_ps(sdepth, stored) :
+                    Func == DF_EQUAL      ? _mm_cmpeq_ps(sdepth, stored) : _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+    __m128i covered = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(static_cast<int>(coverage)), bits), bits);
+    pass = _mm_and_ps(pass, _mm_castsi128_ps(covered));
+
+    uint32_t passed = static_cast<uint32_t>(_mm_movemask_ps(pass));
+    if (DepthWrite && passed)
+        _mm_storeu_ps(depth, _mm_or_ps(_mm_and_ps(pass, sdepth), _mm_andnot_ps(pass, stored)));
+    return passed;
+#else
+    uint32_t passed = 0;
+    for (uint32_t s = 0; s < F_MSAA_SAMPLES; ++s) {
+        float sdepth = bdepth + sampleDepth[s];
+
+        bool pass = Func == DF_LESS       ? sdepth <  depth[s] :
+                    Func == DF_LESS_EQUAL ? sdepth <= depth[s] :
+                    Func == DF_EQUAL      ? sdepth == depth[s] : true;
+        if (!pass || !(coverage & (1u << s)))
+            continue;
+
+        if (DepthWrite)
+            depth[s] = sdepth;
+        passed |= 1u << s;
+    }
+    return passed;
+#endif
+}
+
+// Edge values of a partially covered block fit 32 bits unless the edge is far from the block, in which case
+// it is entirely inside (or outside) and only the sign matters. Stepping across the block changes the value
+// by less than 2^28 within the guard band, so saturating keeps the sign of every pixel.
+static F_INLINE int ClampEdgeValue(int64_t e)
+{
+    const int64_t limit = int64_t(1) << 30;
+    return static_cast<int>(e > limit ? limit : (e < -limit ? -limit : e));
+}
+
+struct IRect2D // [x0, x1) x [y0, y1)
+{
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+// pixels of the 8x8 block at (x, y) inside the clip rectangle, for blocks crossing the edge of the target
+static F_INLINE uint64_t GetBlockClipMask(const IRect2D& rect, int x, int y)
+{
+    int w = imin(rect.x1 - x, 8);
+    int h = imin(rect.y1 - y, 8);
+
+    uint64_t row  = (uint64_t(1) << w) - 1;
+    uint64_t rows = h == 8 ? ~uint64_t(0) : (uint64_t(1) << (h * 8)) - 1;
+    return (row * 0x0101010101010101ull) & rows;
+}
+
+struct FAttribPlane // A(x, y) = a + dadx * x + dady * y, in pixels
+{
+    float a;
+    float dadx;
+    float dady;
+
+    F_INLINE float Eval(int x, int y) const { return a + dadx * fround(x) + dady * fround(y); }
+};
+
+// one tile of the raster stage, rasterizes the triangles binned to it one by one
+struct FTileContext
+{
+    FRenderTarget*       colorRT;
+    FRenderTarget*       depthRT;
+    IRect2D              rect; // the min corner is aligned to 8x8 blocks, the max corner is clipped to the target
+    TBlockCoverageFn     computeBlockCoverage;
+    TBlendPixelsFn       blendPixels;
+    FPipelineStatistics* stats;
+
+    // max depth over the whole tile, refreshed lazily once blocks were written
+    float                maxDepth;
+    bool                 maxDepthDirty;
+};
+
+struct FTriSetup;
+
+typedef void (*TRasterizeTriangleFn)(FTileContext& tile, const FTriSetup& tri);
+
+// triangle prepared for rasterization by the binning stage, streamed by every tile it touches
+struct alignas(64) FTriSetup
+{
+    // half-edge functions in 28.4, E(x, y) = C + DX * y - DY * x with the fill convention applied, inside when > 0
+    int64_t              C[3];
+    int                  DX[3];
+    int                  DY[3];
+
+    // pixel bounds clipped to the target, the min corner is aligned to 8x8 blocks
+    int                  minx;
+    int                  maxx;
+    int                  miny;
+    int                  maxy;
+
+    FAttribPlane         depth;
+    float                minDepth;
+    float                lod;
+    const FTexture*      texture;
+    FSamplerState        sampler;
+    const void*          constants;
+    FBlendState          blend;
+    TRasterizeTriangleFn rasterize; // specialized for the pipeline and the depth and color state of the draw
+    FAttribPlane         varyings[F_MAX_VARYINGS]; // records are allocated with room for the varyings of their triangle only
+};
+
+// pixels of one triangle that passed the depth test, shaded four at a time, lanes past count repeat the first pixel
+struct FPixelShaderInput
+{
+    float           varyings[F_MAX_VARYINGS][4];
+    int             x[4];
+    int             y[4];
+    uint32_t        sampleMask[4]; // bit per sample the pixel writes, 1 on single-sample targets
+    uint32_t        count;
+    const FSampler* sampler;   // the bound texture resolved for the triangle, set up for Textured shaders only
+    const void*     constants; // set with fglSetShaderConstants
+};
+
+// what happens to the shaded colors, rasterizers are specialized for each
+enum EColorOutput
+{
+    CO_NONE  = 0, // color writes are off, nothing is shaded
+    CO_WRITE = 1,
+    CO_BLEND = 2  // blended with the stored colors
+};
+
+// Multisampled color writes. A pixel stays compressed, one color in the target's pixels, while triangles cover
+// all of its samples. The first one to cover only some expands it into the per-sample storage.
+template <EColorOutput Color>
+static F_INLINE void WriteSamples(FTileContext& tile, const FTriSetup& tri, int x, int y, TPixelARGB8 color, uint32_t mask)
+{
+    const uint32_t fullMask = (1u << F_MSAA_SAMPLES) - 1;
+
+    FRenderTarget* rt      = tile.colorRT;
+    size_t         index   = size_t(y) * rt->width + x;
+    TPixelARGB8&   pixel   = reinterpret_cast<TPixelARGB8*>(rt->pixels)[index];
+    TPixelARGB8*   samples = rt->samplePixels + index * F_MSAA_SAMPLES;
+
+    TPixelARGB8 colors[F_MSAA_SAMPLES] = { color, color, color, color };
+
+    if (!rt->sampleFlags[index]) {
+        if (mask == fullMask) {
+            if (Color == CO_BLEND) {
+                TPixelARGB8 stored[F_MSAA_SAMPLES] = { pixel, pixel, pixel, pixel };
+                tile.blendPixels(tri.blend, colors, stored);
+                colors[0] = stored[0];
+            }
+            pixel = colors[0];
+            return;
+        }
+
+        for (uint32_t s = 0; s < F_MSAA_SAMPLES; ++s)
+            samples[s] = pixel;
+        rt->sampleFlags[index] = 1;
+    } else if (mask == fullMask && Color == CO_WRITE) {
+        // covered again, compress
+        pixel = color;
+        rt->sampleFlags[index] = 0;
+        return;
+    }
+
+    if (Color == CO_BLEND) {
+        TPixelARGB8 stored[F_MSAA_SAMPLES] = { samples[0], samples[1], samples[2], samples[3] };
+        tile.blendPixels(tri.blend, colors, stored);
+        for (uint32_t s = 0; s < F_MSAA_SAMPLES; ++s)
+            colors[s] = stored[s];
+    }
+
+    for (uint32_t s = 0; s < F_MSAA_SAMPLES; ++s) {
+        if (mask & (1u << s))
+            samples[s] = colors[s];
+    }
+}
+
+template <typename TShader, EColorOutput Color, bool Multisample>
+static F_INLINE void FlushPixels(FTileContext& tile, const FTriSetup& tri, FPixelShaderInput& quad)
+{
+    if (quad.count == 0)
+        return;
+
+    for (uint32_t i = quad.count; i < 4; ++i) {
+        for (uint32_t v = 0; v < TShader::NumVaryings; ++v)
+            quad.varyings[v][i] = quad.varyings[v][0];
+        quad.x[i] = quad.x[0];
+        quad.y[i] = quad.y[0];
+        quad.sampleMask[i] = quad.sampleMask[0];
+    }
+
+    TPixelARGB8 colors[4];
+    TShader::ShadePixels(quad, colors);
+
+    if (Multisample) {
+        for (uint32_t i = 0; i < quad.count; ++i)
+            WriteSamples<Color>(tile, tri, quad.x[i], quad.y[i], colors[i], quad.sampleMask[i]);
+
+        quad.count = 0;
+        return;
+    }
+
+    if (Color == CO_BLEND) {
+        // the pixels of a quad are distinct, padded lanes read the first one and aren't written
+        TPixelARGB8 stored[4];
+        for (uint32_t i = 0; i < 4; ++i)
+            stored[i] = GetPixel<TPixelARGB8>(tile.colorRT, quad.x[i], quad.y[i]);
+
+        tile.blendPixels(tri.blend, colors, stored);
+
+        for (uint32_t i = 0; i < quad.count; ++i)
+            colors[i] = stored[i];
+    }
+
+    for (uint32_t i = 0; i < quad.count; ++i)
+        WritePixel<TPixelARGB8>(tile.colorRT, quad.x[i], quad.y[i], colors[i]);
+
+    quad.count = 0;
+}
+
+// the color is written once the quad is full
+template <typename TShader, EColorOutput Color, bool Multisample>
+static F_INLINE void ShadeTriPixel(FTileContext& tile, const FTriSetup& tri, FPixelShaderInput& quad, int x, int y, const float* varyings, uint32_t sampleMask)
+{
+    quad.x[quad.count] = x;
+    quad.y[quad.count] = y;
+    quad.sampleMask[quad.count] = sampleMask;
+    for (uint32_t v = 0; v < TShader::NumVaryings; ++v)
+        quad.varyings[v][quad.count] = varyings[v];
+
+    if (++quad.count == 4)
+        FlushPixels<TShader, Color, Multisample>(tile, tri, quad);
+}
+
+// rasterizes the blocks of one triangle inside the tile
+template <typename TShader, EDepthFunc Func, bool DepthWrite, EColorOutput Color>
+static void RasterizeTriangle(FTileContext& tile, const FTriSetup& tri)
+{
+    const bool     ColorWrite = Color != CO_NONE;
+
+    // depth-only draws interpolate nothing but depth
+    const uint32_t NumVaryings = ColorWrite ? TShader::NumVaryings : 0;
+    const bool     HierarchicalZ = Func != DF_ALWAYS;
+
+    FRenderTarget*       depthRT = tile.depthRT;
+    FPipelineStatistics& stats   = *tile.stats;
+
+    // Reject the triangle when it is behind everything in the tile
+    const float triMinDepth = tri.minDepth;
+
+    if (HierarchicalZ) {
+        if (tile.maxDepthDirty) {
+            tile.maxDepth = ComputeMaxDepth(depthRT, tile.rect.x0, tile.rect.y0, tile.rect.x1, tile.rect.y1);
+            tile.maxDepthDirty = false;
+        }
+
+        if (DepthBoundRejects<Func>(triMinDepth, tile.maxDepth)) {
+            stats.hizCulledTriangles++;
+            return;
+        }
+    }
+
+    FSampler sampler;
+    if (TShader::Textured && ColorWrite)
+        SetupSampler(sampler, tri.texture, tri.sampler, tri.lod);
+
+    FPixelShaderInput quad;
+    quad.count     = 0;
+    quad.sampler   = &sampler;
+    quad.constants = tri.constants;
+
+    const int DX12 = tri.DX[0];
+    const int DX23 = tri.DX[1];
+    const int DX31 = tri.DX[2];
+
+    const int DY12 = tri.DY[0];
+    const int DY23 = tri.DY[1];
+    const int DY31 = tri.DY[2];
+
+    // Fixed-point deltas
+    const int FDX12 = DX12 << 4;
+    const int FDX23 = DX23 << 4;
+    const int FDX31 = DX31 << 4;
+
+    const int FDY12 = DY12 << 4;
+    const int FDY23 = DY23 << 4;
+    const int FDY31 = DY31 << 4;
+
+    const int64_t C1 = tri.C[0];
+    const int64_t C2 = tri.C[1];
+    const int64_t C3 = tri.C[2];
+
+    // Block size, standard 8x8 (must be power of two)
+    const int q = 8;
+
+    // Restrict to the tile, the min corners are block-aligned so the walked blocks stay the same
+    const int minx = imax(tri.minx, tile.rect.x0);
+    const int maxx = imin(tri.maxx, tile.rect.x1);
+
+    const int miny = imax(tri.miny, tile.rect.y0);
+    const int maxy = imin(tri.maxy, tile.rect.y1);
+
+    // Loop through blocks
+    for (int y = miny; y < maxy; y += q) {
+        for (int x = minx; x < maxx; x += q) {
+            // Corners of block
+            int64_t x0 = x << 4;
+            int64_t x1 = (x + q - 1) << 4;
+            int64_t y0 = y << 4;
+            int64_t y1 = (y + q - 1) << 4;
+
+            // Evaluate half-space functions
+            int64_t E1 = C1 + DX12 * y0 - DY12 * x0;
+            int64_t E2 = C2 + DX23 * y0 - DY23 * x0;
+            int64_t E3 = C3 + DX31 * y0 - DY31 * x0;
+
+            bool a00 = E1 > 0;
+            bool a10 = E1 - DY12 * (x1 - x0) > 0;
+            bool a01 = E1 + DX12 * (y1 - y0) > 0;
+            bool a11 = E1 + DX12 * (y1 - y0) - DY12 * (x1 - x0) > 0;
+            int a = (a00 << 0) | (a10 << 1) | (a01 << 2) | (a11 << 3);
+
+            bool b00 = E2 > 0;
+            bool b10 = E2 - DY23 * (x1 - x0) > 0;
+            bool b01 = E2 + DX23 * (y1 - y0) > 0;
+            bool b11 = E2 + DX23 * (y1 - y0) - DY23 * (x1 - x0) > 0;
+            int b = (b00 << 0) | (b10 << 1) | (b01 << 2) | (b11 << 3);
+
+            bool c00 = E3 > 0;
+            bool c10 = E3 - DY31 * (x1 - x0) > 0;
+            bool c01 = E3 + DX31 * (y1 - y0) > 0;
+            bool c11 = E3 + DX31 * (y1 - y0) - DY31 * (x1 - x0) > 0;
+            int c = (c00 << 0) | (c10 << 1) | (c01 << 2) | (c11 << 3);
+
+            // Skip block when outside an edge
+            if (a == 0x0 || b == 0x0 || c == 0x0) {
+                stats.blocksSkipped++;
+                continue;
+            }
+
+            // Attributes at the top-left pixel of the block
+            float blockDepth = tri.depth.Eval(x, y);
+
+            // Reject the block when the nearest point of the triangle plane is behind the farthest pixel,
+            // the plane is linear so the minimum is at one of the corners
+            if (HierarchicalZ) {
+                float blockMinDepth = blockDepth
+                    + (tri.depth.dadx < 0.0F ? tri.depth.dadx * (q - 1) : 0.0F)
+                    + (tri.depth.dady < 0.0F ? tri.depth.dady * (q - 1) : 0.0F);
+                blockMinDepth = triMinDepth > blockMinDepth ? triMinDepth : blockMinDepth;
+
+                if (DepthBoundRejects<Func>(blockMinDepth, GetBlockMaxDepth(depthRT, x, y))) {
+                    stats.hizCulledBlocks++;
+                    continue;
+                }
+            }
+
+            float blockVaryings[F_MAX_VARYINGS];
+            for (uint32_t v = 0; v < NumVaryings; ++v)
+                blockVaryings[v] = tri.varyings[v].Eval(x, y);
+
+            uint32_t written = 0;
+
+            // Blocks crossing the edge of the target only cover the pixels inside
+            const bool clipped = x + q > tile.rect.x1 || y + q > tile.rect.y1;
+
+            // Accept whole block when totally covered
+            if (a == 0xF && b == 0xF && c == 0xF && !clipped) {
+                stats.blocksFull++;
+                stats.fragmentsTested += q * q;
+
+                for (int iy = y; iy < y + q; ++iy) {
+                    float depth = blockDepth;
+                    float varyings[F_MAX_VARYINGS];
+                    for (uint32_t v = 0; v < NumVaryings; ++v)
+                        varyings[v] = blockVaryings[v];
+
+                    for (int ix = x; ix < x + q; ++ix) {
+                        #ifdef F_RASTERIZER_VIZ_COVERAGE
+                        WritePixel<TPixelARGB8>(tile.colorRT, ix, iy, FULL_COVERED_COLOR);
+                        #else
+                        if (TestTriPixel<Func, DepthWrite>(depthRT, ix, iy, depth)) {
+                            written++;
+                            if (ColorWrite)
+                                ShadeTriPixel<TShader, Color, false>(tile, tri, quad, ix, iy, varyings, 1);
+                        }
+                        #endif
+
+                        depth += tri.depth.dadx;
+                        for (uint32_t v = 0; v < NumVaryings; ++v)
+                            varyings[v] += tri.varyings[v].dadx;
+                    }
+
+                    blockDepth += tri.depth.dady;
+                    for (uint32_t v = 0; v < NumVaryings; ++v)
+                        blockVaryings[v] += tri.varyings[v].dady;
+                }
+            } else { // Partially covered block
+                const int CY[3]  = { ClampEdgeValue(E1), ClampEdgeValue(E2), ClampEdgeValue(E3) };
+                const int FDX[3] = { FDX12, FDX23, FDX31 };
+                const int FDY[3] = { FDY12, FDY23, FDY31 };
+
+                uint64_t mask = tile.computeBlockCoverage(CY, FDX, FDY);
+                if (clipped)
+                    mask &= GetBlockClipMask(tile.rect, x, y);
+
+                stats.blocksPartial++;
+                stats.fragmentsTested += PopCount(mask);
+
+                while (mask) {
+                    int bit = CountTrailingZeros(mask);
+                    mask &= mask - 1;
+
+                    int bx = bit & (q - 1);
+                    int by = bit >> 3;
+
+                    #ifdef F_RASTERIZER_VIZ_COVERAGE
+                    WritePixel<TPixelARGB8>(tile.colorRT, x + bx, y + by, PARTIALLY_COVERED_COLOR);
+                    #else
+                    float depth = blockDepth + tri.depth.dadx * fround(bx) + tri.depth.dady * fround(by);
+
+                    if (TestTriPixel<Func, DepthWrite>(depthRT, x + bx, y + by, depth)) {
+                        written++;
+
+                        if (ColorWrite) {
+                            float varyings[F_MAX_VARYINGS];
+                            for (uint32_t v = 0; v < NumVaryings; ++v)
+                                varyings[v] = blockVaryings[v] + tri.varyings[v].dadx * fround(bx) + tri.varyings[v].dady * fround(by);
+
+                            ShadeTriPixel<TShader, Color, false>(tile, tri, quad, x + bx, y + by, varyings, 1);
+                        }
+                    }
+                    #endif
+                }
+            }
+
+            if (written) {
+                if (DepthWrite) {
+                    UpdateBlockMaxDepth(depthRT, x, y);
+                    tile.maxDepthDirty = true;
+                }
+                stats.pixelsWritten   += written;
+                stats.fragmentsShaded += ColorWrite ? written : 0;
+            }
+        }
+    }
+
+    if (ColorWrite)
+        FlushPixels<TShader, Color, false>(tile, tri, quad);
+}
+
+// Multisampled targets evaluate coverage and depth per sample, with the edge functions and the depth plane
+// of the triangle offset to the sample positions. Shading still runs once per pixel, at its center.
+template <typename TShader, EDepthFunc Func, bool DepthWrite, EColorOutput Color>
+static void RasterizeTriangleMultisample(FTileContext& tile, const FTriSetup& tri)
+{
+    const bool     ColorWrite    = Color != CO_NONE;
+    const uint32_t NumVaryings   = ColorWrite ? TShader::NumVaryings : 0;
+    const bool     HierarchicalZ = Func != DF_ALWAYS;
+    const uint32_t FullMask      = (1u << F_MSAA_SAMPLES) - 1;
+
+    FRenderTarget*       depthRT = tile.depthRT;
+    FPipelineStatistics& stats   = *tile.stats;
+
+    const float triMinDepth = tri.minDepth;
+
+    if (HierarchicalZ) {
+        if (tile.maxDepthDirty) {
+            tile.maxDepth = ComputeMaxDepth(depthRT, tile.rect.x0, tile.rect.y0, tile.rect.x1, tile.rect.y1);
+            tile.maxDepthDirty = false;
+        }
+
+        if (DepthBoundRejects<Func>(triMinDepth, tile.maxDepth)) {
+            stats.hizCulledTriangles++;
+            return;
+        }
+    }
+
+    FSampler sampler;
+    if (TShader::Textured && ColorWrite)
+        SetupSampler(sampler, tri.texture, tri.sampler, tri.lod);
+
+    FPixelShaderInput quad;
+    quad.count     = 0;
+    quad.sampler   = &sampler;
+    quad.constants = tri.constants;
+
+    // edge and depth offsets from the pixel center to every sample
+    int   sampleEdge[3][F_MSAA_SAMPLES];
+    float sampleDepth[F_MSAA_SAMPLES];
+    for (uint32_t s = 0; s < F_MSAA_SAMPLES; ++s) {
+        const int ox = g_sampleOffsets[s][0];
+        const int oy = g_sampleOffsets[s][1];
+
+        for (int e = 0; e < 3; ++e)
+            sampleEdge[e][s] = tri.DX[e] * oy - tri.DY[e] * ox;
+        sampleDepth[s] = (tri.depth.dadx * fround(ox) + tri.depth.dady * fround(oy)) * (1.0F / 16.0F);
+    }
+
+    // Fixed-point deltas
+    const int FDX[3] = { tri.DX[0] << 4, tri.DX[1] << 4, tri.DX[2] << 4 };
+    const int FDY[3] = { tri.DY[0] << 4, tri.DY[1] << 4, tri.DY[2] << 4 };
+
+    const int q = 8;
+    const int m = F_SAMPLE_EXTENT;
+
+    // the samples of a block reach this far from its top-left pixel center, in pixels
+    const float sampleMin = -m / 16.0F;
+    const float sampleMax = (q - 1) + m / 16.0F;
+
+    const int minx = imax(tri.minx, tile.rect.x0);
+    const int maxx = imin(tri.maxx, tile.rect.x1);
+
+    const int miny = imax(tri.miny, tile.rect.y0);
+    const int maxy = imin(tri.maxy, tile.rect.y1);
+
+    for (int y = miny; y < maxy; y += q) {
+        for (int x = minx; x < maxx; x += q) {
+            // Blocks crossing the edge of the target only cover the samples of the pixels inside
+            const bool clipped = x + q > tile.rect.x1 || y + q > tile.rect.y1;
+
+            // Corners of the block's samples
+            int64_t x0 = (x << 4) - m;
+            int64_t x1 = ((x + q - 1) << 4) + m;
+            int64_t y0 = (y << 4) - m;
+            int64_t y1 = ((y + q - 1) << 4) + m;
+
+            bool outside = false;
+            bool inside  = true;
+            for (int e = 0; e < 3; ++e) {
+                int64_t e00 = tri.C[e] + tri.DX[e] * y0 - tri.DY[e] * x0;
+                int64_t ex  = -tri.DY[e] * (x1 - x0);
+                int64_t ey  = tri.DX[e] * (y1 - y0);
+
+                int corners = (e00 > 0) | ((e00 + ex > 0) << 1) | ((e00 + ey > 0) << 2) | ((e00 + ex + ey > 0) << 3);
+                outside |= corners == 0x0;
+                inside  &= corners == 0xF;
+            }
+
+            if (outside) {
+                stats.blocksSkipped++;
+                continue;
+            }
+
+            float blockDepth = tri.depth.Eval(x, y);
+
+            if (HierarchicalZ) {
+                float blockMinDepth = blockDepth
+                    + tri.depth.dadx * (tri.depth.dadx < 0.0F ? sampleMax : sampleMin)
+                    + tri.depth.dady * (tri.depth.dady < 0.0F ? sampleMax : sampleMin);
+                blockMinDepth = triMinDepth > blockMinDepth ? triMinDepth : blockMinDepth;
+
+                if (DepthBoundRejects<Func>(blockMinDepth, GetBlockMaxDepth(depthRT, x, y))) {
+                    stats.hizCulledBlocks++;
+                    continue;
+                }
+            }
+
+            float blockVaryings[F_MAX_VARYINGS];
+            for (uint32_t v = 0; v < NumVaryings; ++v)
+                blockVaryings[v] = tri.varyings[v].Eval(x, y);
+
+            uint32_t written = 0;
+
+            // Every sample of the block is covered
+            if (inside && !clipped) {
+                stats.blocksFull++;
+                stats.fragmentsTested += q * q;
+
+                for (int iy = y; iy < y + q; ++iy) {
+                    float depth = blockDepth;
+                    float varyings[F_MAX_VARYINGS];
+                    for (uint32_t v = 0; v < NumVaryings; ++v)
+                        varyings[v] = blockVaryings[v];
+
+                    for (int ix = x; ix < x + q; ++ix) {
+                        uint32_t passed = TestTriSamples<Func, DepthWrite>(depthRT, ix, iy, depth, sampleDepth, FullMask);
+                        if (passed) {
+                            written++;
+                            if (ColorWrite)
+                                ShadeTriPixel<TShader, Color, true>(tile, tri, quad, ix, iy, varyings, passed);
+                        }
+
+                        depth += tri.depth.dadx;
+                        for (uint32_t v = 0; v < NumVaryings; ++v)
+                            varyings[v] += tri.varyings[v].dadx;
+                    }
+
+                    blockDepth += tri.depth.dady;
+                    for (uint32_t v = 0; v < NumVaryings; ++v)
+                        blockVaryings[v] += tri.varyings[v].dady;
+                }
+            } else { // Partially covered block, one coverage mask per sample
+                uint64_t masks[F_MSAA_SAMPLES];
+                uint64_t covered = 0;
+                uint64_t clip    = clipped ? GetBlockClipMask(tile.rect, x, y) : ~uint64_t(0);
+
+                for (uint32_t s = 0; s < F_MSAA_SAMPLES; ++s) {
+                    int CY[3];
+                    for (int e = 0; e < 3; ++e)
+                        CY[e] = ClampEdgeValue(tri.C[e] + tri.DX[e] * int64_t(y << 4) - tri.DY[e] * int64_t(x << 4) + sampleEdge[e][s]);
+
+                    masks[s] = tile.computeBlockCoverage(CY, FDX, FDY) & clip;
+                    covered |= masks[s];
+                }
+
+                stats.blocksPartial++;
+                stats.fragmentsTested += PopCount(covered);
+
+                while (covered) {
+                    int bit = CountTrailingZeros(covered);
+                    covered &= covered - 1;
+
+                    int bx = bit & (q - 1);
+                    int by = bit >> 3;
+
+                    uint32_t coverage = 0;
+                    for (uint32_t s = 0; s < F_MSAA_SAMPLES; ++s)
+                        coverage |= uint32_t((masks[s] >> bit) & 1) << s;
+
+                    float depth = blockDepth + tri.depth.dadx * fround(bx) + tri.depth.dady * fround(by);
+
+                    uint32_t passed = TestTriSamples<Func, DepthWrite>(depthRT, x + bx, y + by, depth, sampleDepth, coverage);
+                    if (passed) {
+                        written++;
+
+                        if (ColorWrite) {
+                            float varyings[F_MAX_VARYINGS];
+                            for (uint32_t v = 0; v < NumVaryings; ++v)
+                                varyings[v] = blockVaryings[v] + tri.varyings[v].dadx * fround(bx) + tri.varyings[v].dady * fround(by);
+
+                            ShadeTriPixel<TShader, Color, true>(tile, tri, quad, x + bx, y + by, varyings, passed);
+                        }
+                    }
+                }
+            }
+
+            if (written) {
+                if (DepthWrite) {
+                    UpdateBlockMaxDepth(depthRT, x, y);
+                    tile.maxDepthDirty = true;
+                }
+                stats.pixelsWritten   += written;
+                stats.fragmentsShaded += ColorWrite ? written : 0;
+            }
+        }
+    }
+
+    if (ColorWrite)
+        FlushPixels<TShader, Color, true>(tile, tri, quad);
+}
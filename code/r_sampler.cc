@@ -0,0 +1,256 @@
+#include "r_sampler.hh"
+#include "r_texture.hh"
+#include "e_cpu.hh"
+
+#ifdef F_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef F_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+// filter kernels
+static F_INLINE uint32_t LerpChannel(uint32_t a, uint32_t b, uint32_t w)
+{
+    return (a * 256 + (b - a) * w) >> 8;
+}
+
+static F_INLINE uint32_t LerpTexel(uint32_t a, uint32_t b, uint32_t w)
+{
+    uint32_t ret = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+        ret |= LerpChannel((a >> shift) & 0xFF, (b >> shift) & 0xFF, w) << shift;
+    return ret;
+}
+
+void FilterBilinear_Scalar(const FBilinearQuad& quad, uint32_t out[4])
+{
+    for (int i = 0; i < 4; ++i) {
+        uint32_t top    = LerpTexel(quad.t00[i], quad.t10[i], quad.fx[i]);
+        uint32_t bottom = LerpTexel(quad.t01[i], quad.t11[i], quad.fx[i]);
+        out[i] = LerpTexel(top, bottom, quad.fy[i]);
+    }
+}
+
+#ifdef F_SIMD_SSE2
+// 16-bit lanes, the sum fits 16 bits so the wrapped products are exact
+static F_INLINE __m128i Lerp16_SSE2(__m128i a, __m128i b, __m128i w)
+{
+    __m128i d = _mm_mullo_epi16(_mm_sub_epi16(b, a), w);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_slli_epi16(a, 8), d), 8);
+}
+
+void FilterBilinear_SSE2(const FBilinearQuad& quad, uint32_t out[4])
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i t00 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(quad.t00));
+    __m128i t10 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(quad.t10));
+    __m128i t01 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(quad.t01));
+    __m128i t11 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(quad.t11));
+
+    // weights broadcast to the four channels of every pixel
+    __m128i fx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(quad.fx));
+    __m128i fy = _mm_loadu_si128(reinterpret_cast<const __m128i*>(quad.fy));
+    fx = _mm_packs_epi32(fx, fx);
+    fy = _mm_packs_epi32(fy, fy);
+    fx = _mm_unpacklo_epi16(fx, fx);
+    fy = _mm_unpacklo_epi16(fy, fy);
+
+    __m128i fxLo = _mm_unpacklo_epi32(fx, fx);
+    __m128i fxHi = _mm_unpackhi_epi32(fx, fx);
+    __m128i fyLo = _mm_unpacklo_epi32(fy, fy);
+    __m128i fyHi = _mm_unpackhi_epi32(fy, fy);
+
+    // pixels 0 and 1
+    __m128i topLo    = Lerp16_SSE2(_mm_unpacklo_epi8(t00, zero), _mm_unpacklo_epi8(t10, zero), fxLo);
+    __m128i bottomLo = Lerp16_SSE2(_mm_unpacklo_epi8(t01, zero), _mm_unpacklo_epi8(t11, zero), fxLo);
+    __m128i lo       = Lerp16_SSE2(topLo, bottomLo, fyLo);
+
+    // pixels 2 and 3
+    __m128i topHi    = Lerp16_SSE2(_mm_unpackhi_epi8(t00, zero), _mm_unpackhi_epi8(t10, zero), fxHi);
+    __m128i bottomHi = Lerp16_SSE2(_mm_unpackhi_epi8(t01, zero), _mm_unpackhi_epi8(t11, zero), fxHi);
+    __m128i hi       = Lerp16_SSE2(topHi, bottomHi, fyHi);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(lo, hi));
+}
+#endif
+
+#ifdef F_SIMD_AVX2
+F_TARGET_AVX2 static F_INLINE __m256i Lerp16_AVX2(__m256i a, __m256i b, __m256i w)
+{
+    __m256i d = _mm256_mullo_epi16(_mm256_sub_epi16(b, a), w);
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_slli_epi16(a, 8), d), 8);
+}
+
+F_TARGET_AVX2 static F_INLINE __m256i Load16_AVX2(const uint32_t* src)
+{
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+}
+
+// every weight is below 256, so its low byte is copied into the four channels of its pixel
+F_TARGET_AVX2 static F_INLINE __m256i LoadWeights_AVX2(const uint32_t* src)
+{
+    const __m128i broadcast = _mm_setr_epi8(0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12);
+    __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    return _mm256_cvtepu8_epi16(_mm_shuffle_epi8(w, broadcast));
+}
+
+F_TARGET_AVX2 void FilterBilinear_AVX2(const FBilinearQuad& quad, uint32_t out[4])
+{
+    __m256i fx = LoadWeights_AVX2(quad.fx);
+    __m256i fy = LoadWeights_AVX2(quad.fy);
+
+    __m256i top    = Lerp16_AVX2(Load16_AVX2(quad.t00), Load16_AVX2(quad.t10), fx);
+    __m256i bottom = Lerp16_AVX2(Load16_AVX2(quad.t01), Load16_AVX2(quad.t11), fx);
+    __m256i ret    = Lerp16_AVX2(top, bottom, fy);
+
+    // packing works within 128-bit lanes, gather the low halves of both
+    ret = _mm256_permute4x64_epi64(_mm256_packus_epi16(ret, ret), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(ret));
+}
+#endif
+
+TFilterBilinearFn F_SelectFilterBilinear()
+{
+    uint32_t features = F_GetCpuFeatures();
+    (void)features;
+
+#ifdef F_SIMD_AVX2
+    if (features & CPU_AVX2)
+        return FilterBilinear_AVX2;
+#endif
+#ifdef F_SIMD_SSE2
+    if (features & CPU_SSE2)
+        return FilterBilinear_SSE2;
+#endif
+    return FilterBilinear_Scalar;
+}
+
+static const TFilterBilinearFn g_filterBilinear = F_SelectFilterBilinear();
+
+// sampler
+static F_INLINE FSamplerLevel GetSamplerLevel(const FTexture* tex, uint32_t level)
+{
+    uint32_t width  = GetTextureLevelWidth(tex, level);
+    uint32_t height = GetTextureLevelHeight(tex, level);
+    return { tex->texels + tex->levelOffset[level], width, height, (width + 3) >> 2 };
+}
+
+void SetupSampler(FSampler& sampler, const FTexture* texture, const FSamplerState& state, float lod)
+{
+    sampler.texture   = texture;
+    sampler.state     = state;
+    sampler.lodWeight = 0;
+
+    if (!texture)
+        return;
+
+    uint32_t last = texture->numLevels - 1;
+
+    uint32_t level = 0;
+    if (state.filter == TF_TRILINEAR) {
+        if (lod > 0.0F) {
+            level = lod < static_cast<float>(last) ? static_cast<uint32_t>(lod) : last;
+            if (level < last)
+                sampler.lodWeight = static_cast<uint32_t>((lod - static_cast<float>(level)) * 256.0F) & 0xFF;
+        }
+    } else if (lod > 0.5F) {
+        level = lod < static_cast<float>(last) ? static_cast<uint32_t>(lod + 0.5F) : last;
+    }
+
+    sampler.levels[0] = GetSamplerLevel(texture, level);
+    sampler.levels[1] = GetSamplerLevel(texture, level < last ? level + 1 : last);
+}
+
+static F_INLINE uint32_t AddressTexel(int coord, uint32_t size, ETextureAddress mode)
+{
+    if (mode == TA_WRAP)
+        return static_cast<uint32_t>(coord) & (size - 1);
+
+    int maxCoord = static_cast<int>(size) - 1;
+    return coord < 0 ? 0 : (coord > maxCoord ? maxCoord : coord);
+}
+
+static F_INLINE uint32_t FetchLevelTexel(const FSamplerLevel& level, uint32_t x, uint32_t y)
+{
+    uint32_t morton = (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2);
+    return level.texels[((size_t(y >> 2) * level.tilesX + (x >> 2)) << 4) + morton];
+}
+
+// texel space coordinate, the range is limited so that the conversion can't overflow
+static F_INLINE float ToTexelSpace(float coord, uint32_t size, float scale)
+{
+    float ret = coord * static_cast<float>(size) * scale;
+    const float limit = 1073741824.0F;
+    return ret < -limit ? -limit : (ret > limit ? limit : ret);
+}
+
+static void SampleNearest(const FSampler& sampler, const FSamplerLevel& level, const float u[4], const float v[4], uint32_t out[4])
+{
+    for (int i = 0; i < 4; ++i) {
+        uint32_t x = AddressTexel(ifloor(ToTexelSpace(u[i], level.width, 1.0F)), level.width, sampler.state.addressU);
+        uint32_t y = AddressTexel(ifloor(ToTexelSpace(v[i], level.height, 1.0F)), level.height, sampler.state.addressV);
+        out[i] = FetchLevelTexel(level, x, y);
+    }
+}
+
+static void SampleBilinear(const FSampler& sampler, const FSamplerLevel& level, const float u[4], const float v[4], uint32_t out[4])
+{
+    FBilinearQuad quad;
+
+    for (int i = 0; i < 4; ++i) {
+        // 24.8 fixed point relative to texel centers
+        int fu = ifloor(ToTexelSpace(u[i], level.width, 256.0F)) - 128;
+        int fv = ifloor(ToTexelSpace(v[i], level.height, 256.0F)) - 128;
+
+        int ix = fu >> 8;
+        int iy = fv >> 8;
+
+        uint32_t x0 = AddressTexel(ix,     level.width,  sampler.state.addressU);
+        uint32_t x1 = AddressTexel(ix + 1, level.width,  sampler.state.addressU);
+        uint32_t y0 = AddressTexel(iy,     level.height, sampler.state.addressV);
+        uint32_t y1 = AddressTexel(iy + 1, level.height, sampler.state.addressV);
+
+        quad.t00[i] = FetchLevelTexel(level, x0, y0);
+        quad.t10[i] = FetchLevelTexel(level, x1, y0);
+        quad.t01[i] = FetchLevelTexel(level, x0, y1);
+        quad.t11[i] = FetchLevelTexel(level, x1, y1);
+        quad.fx[i]  = static_cast<uint32_t>(fu) & 0xFF;
+        quad.fy[i]  = static_cast<uint32_t>(fv) & 0xFF;
+    }
+
+    g_filterBilinear(quad, out);
+}
+
+void SampleQuad(const FSampler& sampler, const float u[4], const float v[4], uint32_t out[4])
+{
+    if (!sampler.texture) {
+        for (int i = 0; i < 4; ++i)
+            out[i] = F_ARGB(255u, 255u, 255u, 255u);
+        return;
+    }
+
+    if (sampler.state.filter == TF_NEAREST) {
+        SampleNearest(sampler, sampler.levels[0], u, v, out);
+        return;
+    }
+
+    SampleBilinear(sampler, sampler.levels[0], u, v, out);
+
+    if (sampler.lodWeight != 0) {
+        uint32_t coarse[4];
+        SampleBilinear(sampler, sampler.levels[1], u, v, coarse);
+
+        // blending the two levels is a bilinear filter with both rows equal
+        FBilinearQuad quad;
+        for (int i = 0; i < 4; ++i) {
+            quad.t00[i] = quad.t01[i] = out[i];
+            quad.t10[i] = quad.t11[i] = coarse[i];
+            quad.fx[i]  = sampler.lodWeight;
+            quad.fy[i]  = 0;
+        }
+
+        g_filterBilinear(quad, out);
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "r_draw.hh"
+
+// Texture sampling, four pixels per call. Filtering works on ARGB8 texels in 8.8 fixed point:
+// each pixel's 2x2 footprint is blended with 8-bit weights as (a * 256 + (b - a) * w) >> 8 per channel,
+// first horizontally, then vertically. All implementations give bit-identical results.
+
+// 2x2 footprints of four pixels, texels are t00 t10 in the upper row and t01 t11 in the lower one
+struct FBilinearQuad
+{
+    uint32_t t00[4];
+    uint32_t t10[4];
+    uint32_t t01[4];
+    uint32_t t11[4];
+    uint32_t fx[4]; // 0..255
+    uint32_t fy[4]; // 0..255
+};
+
+typedef void (*TFilterBilinearFn)(const FBilinearQuad& quad, uint32_t out[4]);
+
+void FilterBilinear_Scalar(const FBilinearQuad& quad, uint32_t out[4]);
+#ifdef F_SIMD_SSE2
+void FilterBilinear_SSE2(const FBilinearQuad& quad, uint32_t out[4]);
+#endif
+#ifdef F_SIMD_AVX2
+void FilterBilinear_AVX2(const FBilinearQuad& quad, uint32_t out[4]);
+#endif
+
+// best implementation for the running CPU, the scalar one is the fallback
+TFilterBilinearFn F_SelectFilterBilinear();
+
+struct FSamplerLevel
+{
+    const uint32_t* texels;
+    uint32_t        width;
+    uint32_t        height;
+    uint32_t        tilesX;
+};
+
+// sampler state resolved for one triangle
+struct FSampler
+{
+    const FTexture* texture;    // nullptr samples white
+    FSamplerState   state;
+    FSamplerLevel   levels[2];  // the nearest level, the next coarser one for trilinear blending
+    uint32_t        lodWeight;  // 0..255, weight of levels[1], non-zero for trilinear minification only
+};
+
+void SetupSampler(FSampler& sampler, const FTexture* texture, const FSamplerState& state, float lod);
+
+// u and v are normalized texcoords, out receives ARGB8 colors
+void SampleQuad(const FSampler& sampler, const float u[4], const float v[4], uint32_t out[4]);
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "r_raster.hh"
+
+// Shaders are classes with static members, FPipeline::Allocate compiles the rasterizer for them:
+//
+// struct FMyShader
+// {
+//     static const uint32_t NumVaryings = 2;    // floats interpolated across triangles, at most F_MAX_VARYINGS
+//     static const bool     Textured    = true; // the bound texture is resolved into in.sampler, with the mip level
+//                                               // taken from varyings 0 and 1 as normalized texcoords
+//
+//     // once per vertex and draw, constants are the ones set with fglSetShaderConstants
+//     static void ShadeVertex(const FVertexInput& in, const void* constants, float* varyings);
+//
+//     // four pixels per call, writes ARGB8 colors
+//     static void ShadePixels(const FPixelShaderInput& in, uint32_t colors[4]);
+// };
+//
+// Varyings are interpolated linearly in screen space. Positions are always transformed by the MVP matrix,
+// that keeps the batched SIMD vertex transform.
+
+// attributes of one vertex by semantic, only the components the vertex format declares are meaningful
+struct FVertexInput
+{
+    const float* attributes[VS_COUNT];
+};
+
+// the vertex format of a draw resolved against the bound streams
+struct FVertexFetch
+{
+    uint32_t       numAttributes;
+    uint32_t       semantics[VS_COUNT];
+    const uint8_t* data[VS_COUNT]; // the attribute of vertex 0
+    uint32_t       strides[VS_COUNT];
+    float          zeros[4];       // read by the semantics the format doesn't have
+};
+
+typedef void (*TShadeVerticesFn)(const FVertexFetch& fetch, size_t first, size_t count, const void* constants, float* varyings);
+
+// a shader with the rasterizer specialized for every depth state, color output and sample count
+struct FPipeline
+{
+    uint32_t             numVaryings;
+    bool                 textured;
+    TShadeVerticesFn     shadeVertices; // writes numVaryings floats per vertex
+    TRasterizeTriangleFn rasterize[4][2][3][2]; // [EDepthFunc][depth write][EColorOutput][multisampled]
+
+    template <typename TShader>
+    static FPipeline* Allocate();
+    static void       Release(FPipeline* pipeline);
+};
+
+template <typename TShader>
+static void ShadeVertices(const FVertexFetch& fetch, size_t first, size_t count, const void* constants, float* varyings)
+{
+    FVertexInput in;
+    for (uint32_t s = 0; s < VS_COUNT; ++s)
+        in.attributes[s] = fetch.zeros;
+
+    for (size_t i = first; i < first + count; ++i) {
+        for (uint32_t a = 0; a < fetch.numAttributes; ++a)
+            in.attributes[fetch.semantics[a]] = reinterpret_cast<const float*>(fetch.data[a] + i * fetch.strides[a]);
+
+        TShader::ShadeVertex(in, constants, varyings);
+        varyings += TShader::NumVaryings;
+    }
+}
+
+template <typename TShader, EDepthFunc Func, bool DepthWrite, EColorOutput Color>
+static F_INLINE void SetupRasterizeFunctions(FPipeline* pipeline)
+{
+    pipeline->rasterize[Func][DepthWrite][Color][0] = &RasterizeTriangle<TShader, Func, DepthWrite, Color>;
+    pipeline->rasterize[Func][DepthWrite][Color][1] = &RasterizeTriangleMultisample<TShader, Func, DepthWrite, Color>;
+}
+
+template <typename TShader, EDepthFunc Func>
+static F_INLINE void SetupRasterizeFunctions(FPipeline* pipeline)
+{
+    SetupRasterizeFunctions<TShader, Func, false, CO_NONE>(pipeline);
+    SetupRasterizeFunctions<TShader, Func, false, CO_WRITE>(pipeline);
+    SetupRasterizeFunctions<TShader, Func, false, CO_BLEND>(pipeline);
+    SetupRasterizeFunctions<TShader, Func, true,  CO_NONE>(pipeline);
+    SetupRasterizeFunctions<TShader, Func, true,  CO_WRITE>(pipeline);
+    SetupRasterizeFunctions<TShader, Func, true,  CO_BLEND>(pipeline);
+}
+
+template <typename TShader>
+FPipeline* FPipeline::Allocate()
+{
+    static_assert(TShader::NumVaryings <= F_MAX_VARYINGS, "too many varyings");
+    static_assert(!TShader::Textured || TShader::NumVaryings >= 2, "textured shaders take the mip level from varyings 0 and 1");
+
+    FPipeline* pipeline = new FPipeline;
+    pipeline->numVaryings   = TShader::NumVaryings;
+    pipeline->textured      = TShader::Textured;
+    pipeline->shadeVertices = &ShadeVertices<TShader>;
+
+    SetupRasterizeFunctions<TShader, DF_LESS>(pipeline);
+    SetupRasterizeFunctions<TShader, DF_LESS_EQUAL>(pipeline);
+    SetupRasterizeFunctions<TShader, DF_EQUAL>(pipeline);
+    SetupRasterizeFunctions<TShader, DF_ALWAYS>(pipeline);
+    return pipeline;
+}
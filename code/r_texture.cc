@@ -0,0 +1,98 @@
+#include "r_texture.hh"
+
+#include <cmath>
+#include <vector>
+
+static F_INLINE bool IsPowerOfTwo(uint32_t x) { return x != 0 && (x & (x - 1)) == 0; }
+
+// 2x2 box filter per channel, levels that are one texel wide or high repeat the edge
+static void DownsampleLevel(const std::vector<uint32_t>& src, uint32_t srcWidth, uint32_t srcHeight, std::vector<uint32_t>& dst, uint32_t dstWidth, uint32_t dstHeight)
+{
+    dst.resize(size_t(dstWidth) * dstHeight);
+
+    for (uint32_t y = 0; y < dstHeight; ++y) {
+        for (uint32_t x = 0; x < dstWidth; ++x) {
+            uint32_t x0 = (x * 2) % srcWidth;
+            uint32_t x1 = (x * 2 + 1) % srcWidth;
+            uint32_t y0 = (y * 2) % srcHeight;
+            uint32_t y1 = (y * 2 + 1) % srcHeight;
+
+            uint32_t t00 = src[y0 * srcWidth + x0];
+            uint32_t t10 = src[y0 * srcWidth + x1];
+            uint32_t t01 = src[y1 * srcWidth + x0];
+            uint32_t t11 = src[y1 * srcWidth + x1];
+
+            uint32_t texel = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                uint32_t sum = ((t00 >> shift) & 0xFF) + ((t10 >> shift) & 0xFF) + ((t01 >> shift) & 0xFF) + ((t11 >> shift) & 0xFF);
+                texel |= ((sum + 2) >> 2) << shift;
+            }
+
+            dst[y * dstWidth + x] = texel;
+        }
+    }
+}
+
+FTexture* FTexture::Allocate(uint32_t width, uint32_t height, const uint32_t* data)
+{
+    const uint32_t maxSize = 1u << (F_MAX_TEXTURE_LEVELS - 1);
+
+    if (!IsPowerOfTwo(width) || !IsPowerOfTwo(height) || width > maxSize || height > maxSize)
+        return nullptr;
+
+    FTexture* tex = new FTexture;
+    tex->width = width;
+    tex->height = height;
+    tex->numLevels = 0;
+
+    size_t totalSize = 0;
+    for (uint32_t w = width, h = height; ; w = w > 1 ? w >> 1 : 1, h = h > 1 ? h >> 1 : 1) {
+        tex->levelOffset[tex->numLevels++] = totalSize;
+        totalSize += GetTextureLevelSize(w, h);
+
+        if (w == 1 && h == 1)
+            break;
+    }
+
+    tex->texels = new uint32_t[totalSize];
+
+    // build the chain row-major and swizzle every level into tiles
+    std::vector<uint32_t> level(data, data + size_t(width) * height);
+    std::vector<uint32_t> next;
+
+    for (uint32_t l = 0; l < tex->numLevels; ++l) {
+        uint32_t w = GetTextureLevelWidth(tex, l);
+        uint32_t h = GetTextureLevelHeight(tex, l);
+
+        for (uint32_t y = 0; y < h; ++y) {
+            for (uint32_t x = 0; x < w; ++x)
+                tex->texels[GetTexelOffset(tex, l, x, y)] = level[y * w + x];
+        }
+
+        if (l + 1 < tex->numLevels) {
+            DownsampleLevel(level, w, h, next, GetTextureLevelWidth(tex, l + 1), GetTextureLevelHeight(tex, l + 1));
+            level.swap(next);
+        }
+    }
+
+    return tex;
+}
+
+void FTexture::Release(FTexture* tex)
+{
+    delete [] tex->texels;
+    delete tex;
+}
+
+float ComputeTextureLod(const FTexture* tex, float dudx, float dvdx, float dudy, float dvdy)
+{
+    float w = static_cast<float>(tex->width);
+    float h = static_cast<float>(tex->height);
+
+    float lenX = (dudx * w) * (dudx * w) + (dvdx * h) * (dvdx * h);
+    float lenY = (dudy * w) * (dudy * w) + (dvdy * h) * (dvdy * h);
+    float rho2 = lenX > lenY ? lenX : lenY;
+
+    // log2(sqrt(rho2)), magnification gives negative values
+    return rho2 > 0.0F ? 0.5F * std::log2(rho2) : 0.0F;
+}
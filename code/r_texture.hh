@@ -0,0 +1,48 @@
+#pragma once
+
+#include "r_draw.hh"
+
+// Texel storage: every level is split into 4x4 tiles of 64 bytes, one cache line each.
+// Tiles are stored row by row and the texels inside a tile in Morton order,
+// so a 2x2 footprint stays within one cache line three times out of four.
+
+F_INLINE uint32_t GetTextureLevelWidth(const FTexture* tex, uint32_t level)
+{
+    uint32_t w = tex->width >> level;
+    return w ? w : 1;
+}
+
+F_INLINE uint32_t GetTextureLevelHeight(const FTexture* tex, uint32_t level)
+{
+    uint32_t h = tex->height >> level;
+    return h ? h : 1;
+}
+
+F_INLINE size_t GetTextureLevelSize(uint32_t width, uint32_t height) // in texels, including tile padding
+{
+    return size_t((width + 3) >> 2) * ((height + 3) >> 2) * 16;
+}
+
+F_INLINE size_t GetTexelOffset(const FTexture* tex, uint32_t level, uint32_t x, uint32_t y)
+{
+    uint32_t tilesX = (GetTextureLevelWidth(tex, level) + 3) >> 2;
+    uint32_t morton = (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2);
+    return tex->levelOffset[level] + ((size_t(y >> 2) * tilesX + (x >> 2)) << 4) + morton;
+}
+
+// x and y must be inside the level
+F_INLINE uint32_t FetchTexel(const FTexture* tex, uint32_t level, uint32_t x, uint32_t y)
+{
+    return tex->texels[GetTexelOffset(tex, level, x, y)];
+}
+
+F_INLINE int ifloor(float x)
+{
+    int i = static_cast<int>(x);
+    return i - (x < static_cast<float>(i));
+}
+
+// Level of detail from the screen-space derivatives of the normalized texcoords, that is
+// log2 of the longer texel footprint axis. Texcoords are interpolated linearly in screen space,
+// so the derivatives and the resulting level are constant across a triangle.
+float ComputeTextureLod(const FTexture* tex, float dudx, float dvdx, float dudy, float dvdy);
@@ -0,0 +1,197 @@
+#include "r_transform.hh"
+#include "e_cpu.hh"
+
+#ifdef F_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef F_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+// Every path evaluates m[0] * x + m[4] * y + m[8] * z + m[12] left to right without fused multiply-adds,
+// the viewport as (x / w * 0.5 + 0.5) * width and the snapping as in SnapToSubpixel,
+// so that the results match the scalar code exactly
+
+void TransformVertices_Scalar(const TDrawMatrix& mvp, const FViewport& vp, const float* positions, size_t stride, size_t count, const FTransformedVertices& out)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const float* p = positions + i * stride;
+
+        float x = mvp[0] * p[0] + mvp[4] * p[1] + mvp[8]  * p[2] + mvp[12];
+        float y = mvp[1] * p[0] + mvp[5] * p[1] + mvp[9]  * p[2] + mvp[13];
+        float z = mvp[2] * p[0] + mvp[6] * p[1] + mvp[10] * p[2] + mvp[14];
+        float w = mvp[3] * p[0] + mvp[7] * p[1] + mvp[11] * p[2] + mvp[15];
+
+        out.clipX[i] = x;
+        out.clipY[i] = y;
+        out.clipZ[i] = z;
+        out.clipW[i] = w;
+
+        out.screenX[i] = SnapToSubpixel(((x / w) * 0.5F + 0.5F) * vp.width);
+        out.screenY[i] = SnapToSubpixel(((y / w) * 0.5F + 0.5F) * vp.height);
+        out.depth[i]   = (z / w) * 0.5F;
+
+        out.outcode[i] = ComputeOutcode(vp, x, y, z, w);
+    }
+}
+
+#ifdef F_SIMD_SSE2
+static F_INLINE __m128 OutcodeBit(__m128 mask, uint32_t bit)
+{
+    return _mm_and_ps(mask, _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(bit))));
+}
+
+void TransformVertices_SSE2(const TDrawMatrix& mvp, const FViewport& vp, const float* positions, size_t stride, size_t count, const FTransformedVertices& out)
+{
+    __m128 m[16];
+    for (int i = 0; i < 16; ++i)
+        m[i] = _mm_set1_ps(mvp[i]);
+
+    const __m128 half   = _mm_set1_ps(0.5F);
+    const __m128 width  = _mm_set1_ps(vp.width);
+    const __m128 height = _mm_set1_ps(vp.height);
+
+    const __m128 subpixel  = _mm_set1_ps(16.0F);
+    const __m128 halfPixel = _mm_set1_ps(8.0F);
+
+    const __m128 gbMinX = _mm_set1_ps(vp.gbMinX);
+    const __m128 gbMaxX = _mm_set1_ps(vp.gbMaxX);
+    const __m128 gbMinY = _mm_set1_ps(vp.gbMinY);
+    const __m128 gbMaxY = _mm_set1_ps(vp.gbMaxY);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float* p0 = positions + i * stride;
+        const float* p1 = p0 + stride;
+        const float* p2 = p1 + stride;
+        const float* p3 = p2 + stride;
+
+        // AoS to SoA
+        __m128 px = _mm_setr_ps(p0[0], p1[0], p2[0], p3[0]);
+        __m128 py = _mm_setr_ps(p0[1], p1[1], p2[1], p3[1]);
+        __m128 pz = _mm_setr_ps(p0[2], p1[2], p2[2], p3[2]);
+
+        __m128 x = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], px), _mm_mul_ps(m[4], py)), _mm_mul_ps(m[8],  pz)), m[12]);
+        __m128 y = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1], px), _mm_mul_ps(m[5], py)), _mm_mul_ps(m[9],  pz)), m[13]);
+        __m128 z = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2], px), _mm_mul_ps(m[6], py)), _mm_mul_ps(m[10], pz)), m[14]);
+        __m128 w = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[3], px), _mm_mul_ps(m[7], py)), _mm_mul_ps(m[11], pz)), m[15]);
+
+        _mm_storeu_ps(out.clipX + i, x);
+        _mm_storeu_ps(out.clipY + i, y);
+        _mm_storeu_ps(out.clipZ + i, z);
+        _mm_storeu_ps(out.clipW + i, w);
+
+        __m128 sx = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_div_ps(x, w), half), half), width);
+        __m128 sy = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_div_ps(y, w), half), half), height);
+        __m128 sz = _mm_mul_ps(_mm_div_ps(z, w), half);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out.screenX + i), _mm_cvtps_epi32(_mm_sub_ps(_mm_mul_ps(sx, subpixel), halfPixel)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out.screenY + i), _mm_cvtps_epi32(_mm_sub_ps(_mm_mul_ps(sy, subpixel), halfPixel)));
+        _mm_storeu_ps(out.depth + i, sz);
+
+        __m128 negw = _mm_sub_ps(_mm_setzero_ps(), w);
+        __m128 code = _mm_or_ps(
+            _mm_or_ps(
+                _mm_or_ps(OutcodeBit(_mm_cmplt_ps(x, negw), CP_LEFT),   OutcodeBit(_mm_cmpgt_ps(x, w), CP_RIGHT)),
+                _mm_or_ps(OutcodeBit(_mm_cmplt_ps(y, negw), CP_BOTTOM), OutcodeBit(_mm_cmpgt_ps(y, w), CP_TOP))),
+            _mm_or_ps(
+                _mm_or_ps(OutcodeBit(_mm_cmplt_ps(z, negw), CP_NEAR),   OutcodeBit(_mm_cmpgt_ps(z, w), CP_FAR)),
+                _mm_or_ps(
+                    _mm_or_ps(OutcodeBit(_mm_cmplt_ps(x, _mm_mul_ps(gbMinX, w)), CP_GB_LEFT),   OutcodeBit(_mm_cmpgt_ps(x, _mm_mul_ps(gbMaxX, w)), CP_GB_RIGHT)),
+                    _mm_or_ps(OutcodeBit(_mm_cmplt_ps(y, _mm_mul_ps(gbMinY, w)), CP_GB_BOTTOM), OutcodeBit(_mm_cmpgt_ps(y, _mm_mul_ps(gbMaxY, w)), CP_GB_TOP)))));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out.outcode + i), _mm_castps_si128(code));
+    }
+
+    FTransformedVertices tail = { out.clipX + i, out.clipY + i, out.clipZ + i, out.clipW + i, out.screenX + i, out.screenY + i, out.depth + i, out.outcode + i };
+    TransformVertices_Scalar(mvp, vp, positions + i * stride, stride, count - i, tail);
+}
+#endif
+
+#ifdef F_SIMD_AVX2
+F_TARGET_AVX2 static F_INLINE __m256 OutcodeBit256(__m256 mask, uint32_t bit)
+{
+    return _mm256_and_ps(mask, _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(bit))));
+}
+
+F_TARGET_AVX2 void TransformVertices_AVX2(const TDrawMatrix& mvp, const FViewport& vp, const float* positions, size_t stride, size_t count, const FTransformedVertices& out)
+{
+    __m256 m[16];
+    for (int i = 0; i < 16; ++i)
+        m[i] = _mm256_set1_ps(mvp[i]);
+
+    const __m256 half   = _mm256_set1_ps(0.5F);
+    const __m256 width  = _mm256_set1_ps(vp.width);
+    const __m256 height = _mm256_set1_ps(vp.height);
+
+    const __m256 subpixel  = _mm256_set1_ps(16.0F);
+    const __m256 halfPixel = _mm256_set1_ps(8.0F);
+
+    const __m256 gbMinX = _mm256_set1_ps(vp.gbMinX);
+    const __m256 gbMaxX = _mm256_set1_ps(vp.gbMaxX);
+    const __m256 gbMinY = _mm256_set1_ps(vp.gbMinY);
+    const __m256 gbMaxY = _mm256_set1_ps(vp.gbMaxY);
+
+    // gather the components of eight positions, the stride of a vertex buffer is far below 2^28 floats
+    const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(static_cast<int>(stride)));
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const float* base = positions + i * stride;
+
+        __m256 px = _mm256_i32gather_ps(base + 0, offsets, 4);
+        __m256 py = _mm256_i32gather_ps(base + 1, offsets, 4);
+        __m256 pz = _mm256_i32gather_ps(base + 2, offsets, 4);
+
+        __m256 x = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0], px), _mm256_mul_ps(m[4], py)), _mm256_mul_ps(m[8],  pz)), m[12]);
+        __m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[1], px), _mm256_mul_ps(m[5], py)), _mm256_mul_ps(m[9],  pz)), m[13]);
+        __m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[2], px), _mm256_mul_ps(m[6], py)), _mm256_mul_ps(m[10], pz)), m[14]);
+        __m256 w = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[3], px), _mm256_mul_ps(m[7], py)), _mm256_mul_ps(m[11], pz)), m[15]);
+
+        _mm256_storeu_ps(out.clipX + i, x);
+        _mm256_storeu_ps(out.clipY + i, y);
+        _mm256_storeu_ps(out.clipZ + i, z);
+        _mm256_storeu_ps(out.clipW + i, w);
+
+        __m256 sx = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(x, w), half), half), width);
+        __m256 sy = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(y, w), half), half), height);
+        __m256 sz = _mm256_mul_ps(_mm256_div_ps(z, w), half);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.screenX + i), _mm256_cvtps_epi32(_mm256_sub_ps(_mm256_mul_ps(sx, subpixel), halfPixel)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.screenY + i), _mm256_cvtps_epi32(_mm256_sub_ps(_mm256_mul_ps(sy, subpixel), halfPixel)));
+        _mm256_storeu_ps(out.depth + i, sz);
+
+        __m256 negw = _mm256_sub_ps(_mm256_setzero_ps(), w);
+        __m256 code = _mm256_or_ps(
+            _mm256_or_ps(
+                _mm256_or_ps(OutcodeBit256(_mm256_cmp_ps(x, negw, _CMP_LT_OQ), CP_LEFT),   OutcodeBit256(_mm256_cmp_ps(x, w, _CMP_GT_OQ), CP_RIGHT)),
+                _mm256_or_ps(OutcodeBit256(_mm256_cmp_ps(y, negw, _CMP_LT_OQ), CP_BOTTOM), OutcodeBit256(_mm256_cmp_ps(y, w, _CMP_GT_OQ), CP_TOP))),
+            _mm256_or_ps(
+                _mm256_or_ps(OutcodeBit256(_mm256_cmp_ps(z, negw, _CMP_LT_OQ), CP_NEAR),   OutcodeBit256(_mm256_cmp_ps(z, w, _CMP_GT_OQ), CP_FAR)),
+                _mm256_or_ps(
+                    _mm256_or_ps(OutcodeBit256(_mm256_cmp_ps(x, _mm256_mul_ps(gbMinX, w), _CMP_LT_OQ), CP_GB_LEFT),   OutcodeBit256(_mm256_cmp_ps(x, _mm256_mul_ps(gbMaxX, w), _CMP_GT_OQ), CP_GB_RIGHT)),
+                    _mm256_or_ps(OutcodeBit256(_mm256_cmp_ps(y, _mm256_mul_ps(gbMinY, w), _CMP_LT_OQ), CP_GB_BOTTOM), OutcodeBit256(_mm256_cmp_ps(y, _mm256_mul_ps(gbMaxY, w), _CMP_GT_OQ), CP_GB_TOP)))));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out.outcode + i), _mm256_castps_si256(code));
+    }
+
+    FTransformedVertices tail = { out.clipX + i, out.clipY + i, out.clipZ + i, out.clipW + i, out.screenX + i, out.screenY + i, out.depth + i, out.outcode + i };
+    TransformVertices_Scalar(mvp, vp, positions + i * stride, stride, count - i, tail);
+}
+#endif
+
+TTransformVerticesFn F_SelectTransformVertices()
+{
+    uint32_t features = F_GetCpuFeatures();
+    (void)features;
+
+#ifdef F_SIMD_AVX2
+    if (features & CPU_AVX2)
+        return TransformVertices_AVX2;
+#endif
+#ifdef F_SIMD_SSE2
+    if (features & CPU_SSE2)
+        return TransformVertices_SSE2;
+#endif
+    return TransformVertices_Scalar;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "r_draw.hh"
+
+#include <cmath>
+
+// outcode bits, the first six are the view volume and the last four the guard band
+enum EClipPlane
+{
+    CP_LEFT      = 1 << 0,
+    CP_RIGHT     = 1 << 1,
+    CP_BOTTOM    = 1 << 2,
+    CP_TOP       = 1 << 3,
+    CP_NEAR      = 1 << 4,
+    CP_FAR       = 1 << 5,
+
+    CP_GB_LEFT   = 1 << 6,
+    CP_GB_RIGHT  = 1 << 7,
+    CP_GB_BOTTOM = 1 << 8,
+    CP_GB_TOP    = 1 << 9,
+
+    CP_VIEW_VOLUME = CP_LEFT | CP_RIGHT | CP_BOTTOM | CP_TOP | CP_NEAR | CP_FAR,
+    CP_MUST_CLIP   = CP_NEAR | CP_FAR | CP_GB_LEFT | CP_GB_RIGHT | CP_GB_BOTTOM | CP_GB_TOP
+};
+
+// Screen coordinates are kept within +-F_GUARD_BAND pixels, this bounds the bounding boxes walked by the
+// rasterizer and keeps the 28.4 edge deltas small enough for the 32-bit per-pixel stepping
+#define F_GUARD_BAND 16384
+
+struct FViewport
+{
+    float width;
+    float height;
+
+    // guard band planes in NDC, x >= gbMinX * w and so on
+    float gbMinX;
+    float gbMaxX;
+    float gbMinY;
+    float gbMaxY;
+};
+
+F_INLINE FViewport SetupViewport(int width, int height)
+{
+    FViewport vp;
+    vp.width  = static_cast<float>(width);
+    vp.height = static_cast<float>(height);
+
+    // screen x = (ndc x * 0.5 + 0.5) * width
+    vp.gbMinX = -2.0F * F_GUARD_BAND / vp.width  - 1.0F;
+    vp.gbMaxX =  2.0F * F_GUARD_BAND / vp.width  - 1.0F;
+    vp.gbMinY = -2.0F * F_GUARD_BAND / vp.height - 1.0F;
+    vp.gbMaxY =  2.0F * F_GUARD_BAND / vp.height - 1.0F;
+    return vp;
+}
+
+F_INLINE uint32_t ComputeOutcode(const FViewport& vp, float x, float y, float z, float w)
+{
+    uint32_t code = 0;
+
+    if (x < -w) code |= CP_LEFT;
+    if (x >  w) code |= CP_RIGHT;
+    if (y < -w) code |= CP_BOTTOM;
+    if (y >  w) code |= CP_TOP;
+    if (z < -w) code |= CP_NEAR;
+    if (z >  w) code |= CP_FAR;
+
+    if (x < vp.gbMinX * w) code |= CP_GB_LEFT;
+    if (x > vp.gbMaxX * w) code |= CP_GB_RIGHT;
+    if (y < vp.gbMinY * w) code |= CP_GB_BOTTOM;
+    if (y > vp.gbMaxY * w) code |= CP_GB_TOP;
+
+    return code;
+}
+
+// Screen positions are 28.4 fixed point and shifted by half a pixel, so that integer coordinates are pixel centers.
+// screen is the viewport coordinate in pixels, rounding is to nearest even like the SIMD conversions.
+F_INLINE int SnapToSubpixel(float screen)
+{
+    return static_cast<int>(std::lrint(screen * 16.0F - 8.0F));
+}
+
+// transformed vertices in structure-of-arrays layout
+struct FTransformedVertices
+{
+    float*    clipX;
+    float*    clipY;
+    float*    clipZ;
+    float*    clipW;
+
+    // perspective divide and viewport, only meaningful when the outcode has no CP_MUST_CLIP bits
+    int*      screenX; // 28.4, see SnapToSubpixel
+    int*      screenY;
+    float*    depth;
+
+    uint32_t* outcode;
+};
+
+// Transforms count positions by the column-major MVP matrix and writes element i of every output array.
+// Position i is positions[i * stride] to positions[i * stride + 2]. All implementations produce bit-identical results.
+typedef void (*TTransformVerticesFn)(const TDrawMatrix& mvp, const FViewport& vp, const float* positions, size_t stride, size_t count, const FTransformedVertices& out);
+
+void TransformVertices_Scalar(const TDrawMatrix& mvp, const FViewport& vp, const float* positions, size_t stride, size_t count, const FTransformedVertices& out);
+#ifdef F_SIMD_SSE2
+void TransformVertices_SSE2(const TDrawMatrix& mvp, const FViewport& vp, const float* positions, size_t stride, size_t count, const FTransformedVertices& out);
+#endif
+#ifdef F_SIMD_AVX2
+void TransformVertices_AVX2(const TDrawMatrix& mvp, const FViewport& vp, const float* positions, size_t stride, size_t count, const FTransformedVertices& out);
+#endif
+
+// best implementation for the running CPU, the scalar one is the fallback
+TTransformVerticesFn F_SelectTransformVertices();